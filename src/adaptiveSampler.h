@@ -0,0 +1,81 @@
+#include <math.h>
+#include "smoothing.h"
+
+#ifndef AdaptiveSampler_H_
+#define AdaptiveSampler_H_
+
+/*
+Chooses the time until the next CO2 reading from the rate of change.
+
+An empty room at night hardly changes, so the interval grows step by step up to
+maxInterval, which cuts sensor traffic, radio use and Influx points. As soon as the
+slope gets steep (people entering, window opened) it drops back to minInterval.
+Sensor noise (a few ppm) is subtracted before the slope is computed so a flat
+signal is recognized as stable. The allowance fades for readings further apart
+than minInterval, otherwise it would hide a slow but steady rise at long
+intervals.
+*/
+
+#define ADAPTIVE_NOISE_PPM 10.0f   // readings minInterval apart and closer than this count as unchanged
+#define ADAPTIVE_NOISE_TAU 45.0f   // s, fading of the noise allowance beyond minInterval
+#define ADAPTIVE_STABLE_SLOPE 2.0f // ppm/min, below this the interval grows
+#define ADAPTIVE_STEEP_SLOPE 15.0f // ppm/min, above this the interval drops to minInterval
+#define ADAPTIVE_GROWTH 1.5f
+
+struct AdaptiveSampler
+{
+    unsigned long minInterval = 10000;
+    unsigned long maxInterval = 120000;
+    unsigned long interval = 10000;
+    float slope = 0.0f; // ppm/min of the last two readings, noise removed
+    float lastPPM = NAN;
+    unsigned long lastTime = 0;
+};
+
+void setSamplerBounds(AdaptiveSampler &sampler, unsigned long minInterval, unsigned long maxInterval)
+{
+    sampler.minInterval = minInterval;
+    sampler.maxInterval = maxInterval < minInterval ? minInterval : maxInterval;
+    if (sampler.interval < sampler.minInterval || sampler.interval > sampler.maxInterval)
+    {
+        sampler.interval = sampler.minInterval;
+    }
+}
+
+// Feed a reading taken at now (ms), returns the interval until the next one
+unsigned long nextSampleInterval(AdaptiveSampler &sampler, float ppm, unsigned long now)
+{
+    if (!isnan(sampler.lastPPM) && now != sampler.lastTime)
+    {
+        float beyond = ((long)(now - sampler.lastTime) - (long)sampler.minInterval) / 1000.0f;
+        float noise = ADAPTIVE_NOISE_PPM * (1.0f - smoothingWeight(beyond, ADAPTIVE_NOISE_TAU));
+        float change = fabsf(ppm - sampler.lastPPM) - noise;
+        sampler.slope = (change > 0.0f ? change : 0.0f) * 60000.0f / (now - sampler.lastTime);
+
+        if (sampler.slope > ADAPTIVE_STEEP_SLOPE)
+        {
+            sampler.interval = sampler.minInterval;
+        }
+        else if (sampler.slope < ADAPTIVE_STABLE_SLOPE)
+        {
+            sampler.interval = sampler.interval * ADAPTIVE_GROWTH;
+        }
+        else if (sampler.interval > 2 * sampler.minInterval)
+        {
+            sampler.interval /= 2; // moderate change, get closer again
+        }
+        if (sampler.interval > sampler.maxInterval)
+        {
+            sampler.interval = sampler.maxInterval;
+        }
+        if (sampler.interval < sampler.minInterval)
+        {
+            sampler.interval = sampler.minInterval;
+        }
+    }
+    sampler.lastPPM = ppm;
+    sampler.lastTime = now;
+    return sampler.interval;
+}
+
+#endif
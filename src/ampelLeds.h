@@ -6,10 +6,12 @@
 #define LED_PIN 5
 #define COLOR_ORDER GRB
 #define CHIPSET WS2811
-#define NUM_LEDS 8
+#define NUM_LEDS 8 // LEDs of the scene, ledLayout.h maps them onto the strips
 #define FRAMES_PER_SECOND 200
+#define CO2_ALARM_PPM 2000.0 // the CO2 LEDs pulse from here on
 
 CRGB leds[NUM_LEDS];
+float scenePPM = NAN; // last value passed to showCO2()
 bool gReverseDirection = false;
 
 CRGB green[3];
@@ -51,6 +53,7 @@ void defineColors()
 
 void showCO2(float ppm)
 {
+    scenePPM = ppm;
     if (ppm < 800.0)
     {
         leds[5] = off;
@@ -0,0 +1,149 @@
+#include <math.h>
+
+#ifndef CO2Forecast_H_
+#define CO2Forecast_H_
+
+/*
+Forecasts the CO2 level FORECAST_HORIZON ahead to warn before a threshold is crossed.
+
+With constant occupancy and ventilation the level approaches a steady state
+exponentially, C(t) = Css + (C - Css) * exp(-lambda * t). The window keeps one
+reading per FORECAST_STEP; the slopes of its older and newer half give lambda
+(s_new / s_old = exp(-lambda * dt)) and the newer slope gives Css = C + s_new / lambda.
+If the slopes don't show a clean approach (noise, sign change) lambda falls back to
+the leakage rate of a closed room.
+
+A fit like that usually means the room just changed (windows opened or closed, a
+lesson started) and extrapolating it does worse than the current reading. The
+forecast is then pulled towards the current reading: by FORECAST_TURN_WEIGHT
+after a sign change, FORECAST_RISE_WEIGHT for a slope that is still growing, and
+all the way if lambda hits FORECAST_MAX_LAMBDA. Once the level is above
+FORECAST_WARN_PPM the warning stays off until it drops FORECAST_WARN_HYSTERESIS
+below, the noise around the threshold would switch it back and forth.
+
+A few multiplications, one logf and one expf per reading, constant memory.
+*/
+
+#define FORECAST_WINDOW 8
+#define FORECAST_STEP 60000UL     // ms between window entries
+#define FORECAST_HORIZON 900.0f   // s, 15 minutes
+#define FORECAST_WARN_PPM 1000.0f // "ventilate soon" when the forecast reaches this
+#define FORECAST_MIN_LAMBDA 0.3f  // 1/h, closed room
+#define FORECAST_MAX_LAMBDA 10.0f // 1/h, wide open windows
+#define FORECAST_MIN_SLOPE 1.5f   // ppm/min, flatter is sensor noise
+#define FORECAST_TURN_WEIGHT 0.3f // share of the forecast change kept after a sign change of the slope
+#define FORECAST_RISE_WEIGHT 0.7f // same for a slope that is getting steeper
+#define FORECAST_WARN_HYSTERESIS 50.0f // ppm
+
+struct CO2Forecast
+{
+    float ppm[FORECAST_WINDOW];
+    float minutes[FORECAST_WINDOW]; // relative to start, float keeps the fit cheap
+    int count = 0;
+    int head = 0; // next slot to write
+    unsigned long start = 0;
+    unsigned long lastStep = 0;
+    float lambda = FORECAST_MIN_LAMBDA; // 1/h
+    float predicted = NAN;              // ppm at the horizon
+    bool warn = false;
+    bool above = false; // level reached FORECAST_WARN_PPM and didn't drop below the hysteresis since
+};
+
+// Least squares slope (ppm/min) of count entries starting first entries after the oldest
+float windowSlope(const CO2Forecast &f, int first, int count)
+{
+    float sx = 0.0f, sy = 0.0f, sxx = 0.0f, sxy = 0.0f;
+    int oldest = (f.head - f.count + FORECAST_WINDOW) % FORECAST_WINDOW;
+    for (int i = 0; i < count; i++)
+    {
+        int idx = (oldest + first + i) % FORECAST_WINDOW;
+        float x = f.minutes[idx];
+        sx += x;
+        sy += f.ppm[idx];
+        sxx += x * x;
+        sxy += x * f.ppm[idx];
+    }
+    float d = count * sxx - sx * sx;
+    return d > 0.0f ? (count * sxy - sx * sy) / d : 0.0f;
+}
+
+// Feed a reading taken at now (ms), returns the forecast in ppm
+float updateForecast(CO2Forecast &f, float ppm, unsigned long now)
+{
+    if (f.count == 0)
+    {
+        f.start = now;
+        f.lastStep = now;
+    }
+    else if (now - f.lastStep < FORECAST_STEP)
+    {
+        // same step, keep the newest reading in the current slot
+        f.head = (f.head - 1 + FORECAST_WINDOW) % FORECAST_WINDOW;
+        f.count--;
+    }
+    else
+    {
+        f.lastStep = now;
+    }
+    f.ppm[f.head] = ppm;
+    f.minutes[f.head] = (now - f.start) / 60000.0f;
+    f.head = (f.head + 1) % FORECAST_WINDOW;
+    if (f.count < FORECAST_WINDOW)
+    {
+        f.count++;
+    }
+
+    if (f.count < 4)
+    {
+        f.predicted = NAN;
+        f.warn = false;
+        return f.predicted;
+    }
+
+    int half = f.count / 2;
+    float oldSlope = windowSlope(f, 0, half);
+    float newSlope = windowSlope(f, f.count - half, half);
+
+    int oldest = (f.head - f.count + FORECAST_WINDOW) % FORECAST_WINDOW;
+    int newest = (f.head - 1 + FORECAST_WINDOW) % FORECAST_WINDOW;
+    float dt = (f.minutes[newest] - f.minutes[oldest]) / 2.0f / 60.0f; // h between the half centres
+
+    f.lambda = FORECAST_MIN_LAMBDA;
+    float weight = oldSlope * newSlope <= 0.0f ? FORECAST_TURN_WEIGHT : FORECAST_RISE_WEIGHT;
+    if (dt > 0.0f && oldSlope * newSlope > 0.0f && fabsf(newSlope) < fabsf(oldSlope))
+    {
+        weight = 1.0f;
+        f.lambda = logf(oldSlope / newSlope) / dt;
+        if (f.lambda > FORECAST_MAX_LAMBDA)
+        {
+            // no exponential approach is that fast, the slopes are noise or a step
+            f.lambda = FORECAST_MAX_LAMBDA;
+            weight = 0.0f;
+        }
+        if (f.lambda < FORECAST_MIN_LAMBDA)
+        {
+            f.lambda = FORECAST_MIN_LAMBDA;
+        }
+    }
+
+    if (fabsf(newSlope) < FORECAST_MIN_SLOPE)
+    {
+        newSlope = 0.0f;
+    }
+    // steady state from the current slope, forecast along the exponential
+    float steadyState = ppm + newSlope * 60.0f / f.lambda;
+    float predicted = steadyState + (ppm - steadyState) * expf(-f.lambda * FORECAST_HORIZON / 3600.0f);
+    f.predicted = ppm + weight * (predicted - ppm);
+    if (ppm >= FORECAST_WARN_PPM)
+    {
+        f.above = true;
+    }
+    else if (ppm < FORECAST_WARN_PPM - FORECAST_WARN_HYSTERESIS)
+    {
+        f.above = false;
+    }
+    f.warn = !f.above && f.predicted >= FORECAST_WARN_PPM;
+    return f.predicted;
+}
+
+#endif
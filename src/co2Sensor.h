@@ -0,0 +1,94 @@
+#include <Arduino.h>
+
+#ifndef CO2Sensor_H_
+#define CO2Sensor_H_
+
+/*
+Common interface for the supported CO2 sensors (MH-Z19, SenseAir S8, SCD30, SCD4x).
+
+Every driver is polled from loop(). poll() never waits for the sensor: it sends a
+request or collects a pending answer and returns true only when a new reading is
+available. The drivers get their bus (Stream or TwoWire) passed in, so they only
+talk to the hardware through it.
+*/
+
+#define SENSOR_CAP_CO2 0x01
+#define SENSOR_CAP_TEMPERATURE 0x02
+#define SENSOR_CAP_HUMIDITY 0x04
+#define SENSOR_CAP_NATIVE_ABC 0x08
+#define SENSOR_CAP_FORCED_CALIBRATION 0x10
+#define SENSOR_CAP_FIRMWARE_CALIBRATION 0x20 // own ABC is unreliable, readCO2() calibrates from the readings instead
+
+struct SensorReading
+{
+    float co2 = 0.0f;
+    float temperature = NAN; // NAN if the sensor has no temperature output
+    float humidity = NAN;    // NAN if the sensor has no humidity output
+};
+
+class CO2Sensor
+{
+public:
+    virtual ~CO2Sensor() {}
+
+    virtual const char *name() const = 0;
+    virtual uint8_t capabilities() const = 0;
+    // How often the sensor produces a new value (ms)
+    virtual unsigned long measurementPeriod() const = 0;
+
+    // Probe the bus, returns true if the sensor answered and is configured
+    virtual bool begin() = 0;
+    // Non-blocking, returns true and fills reading if a new value is available
+    virtual bool poll(SensorReading &reading) = 0;
+    // Set the current reading to ppm (400 ppm ~ fresh outside air)
+    virtual bool calibrate(uint16_t ppm) = 0;
+    virtual void setNativeABC(bool /* enabled */) {}
+
+    bool ok() const { return isOK; }
+    bool hasCapability(uint8_t capability) const { return (capabilities() & capability) != 0; }
+    // Requests to the sensor since boot and the ones that failed (timeout, CRC, error status)
+    unsigned long transactions() const { return transactionCount; }
+    unsigned long failures() const { return failureCount; }
+
+protected:
+    bool isOK = false;
+    unsigned long transactionCount = 0;
+    unsigned long failureCount = 0;
+
+    bool countTransaction(bool success)
+    {
+        transactionCount++;
+        failureCount += success ? 0 : 1;
+        return success;
+    }
+};
+
+// Drops whatever is waiting on a UART, e.g. the answer to another sensor's probe
+void drainStream(Stream &serial)
+{
+    while (serial.available())
+    {
+        serial.read();
+    }
+}
+
+// Returns the first candidate that answers on its bus or nullptr
+CO2Sensor *detectCO2Sensor(CO2Sensor *const *candidates, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        Serial.print("Probing ");
+        Serial.print(candidates[i]->name());
+        Serial.println(" ..");
+        if (candidates[i]->begin())
+        {
+            Serial.print("Found ");
+            Serial.println(candidates[i]->name());
+            return candidates[i];
+        }
+    }
+    Serial.println("Could not find a CO2 sensor, check wiring!");
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,235 @@
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "ledBrightness.h"
+#include "ledLayout.h"
+#include "roomAnalytics.h"
+#include "tempCompensation.h"
+
+#ifndef Config_H_
+#define Config_H_
+
+/*
+The settings kept in /config.json and how a config object is applied to them.
+applyParams() takes the object from /config.json, a remote config or a
+provisioning bundle; every key is optional and only the keys present change.
+Strings are copied bounded and numbers are range checked as the latter two come
+from the network. provisioningSeq, remoteConfigVersion and remoteConfigETag are
+the device's own bookkeeping against replayed documents, only /config.json sets
+them.
+*/
+
+#define MEASUREMENT_INTERVAL 10000
+#define MIN_MEASUREMENT_INTERVAL 5000
+#define MAX_MEASUREMENT_INTERVAL 600000
+#define MAX_ADAPTIVE_INTERVAL 120000 // longest interval while the readings are stable
+#define CONFIG_DOC_SIZE 3072 // /config.json with every string full and MAX_SEGMENTS LED segments is about 2.4 kB
+
+char influxDBURL[40] = "";
+char influxDBOrg[32] = "";
+char influxDBBucket[32] = "";
+char influxDBToken[128] = "";
+char lastestVersionURL[60] = "";
+char firmwarePath[60] = "";
+char remoteConfigURL[100] = "";
+char useWifi[2] = "1";
+char tempOffsetBME[5] = "-3.0";
+char mqttHost[64] = "";
+char mqttPort[6] = "1883";
+char mqttUser[32] = "";
+char mqttPass[64] = "";
+char mqttTopic[64] = "";                 // empty: co2ampel/<chipId>
+char mqttDiscovery[24] = "homeassistant"; // empty disables Home Assistant discovery
+
+// POSIX TZ string for the brightness schedule, default Central Europe
+char timeZone[48] = "CET-1CEST,M3.5.0,M10.5.0/3";
+
+unsigned long measurementInterval = MEASUREMENT_INTERVAL;
+unsigned long maxMeasurementInterval = MAX_ADAPTIVE_INTERVAL;
+float roomVolume = ROOM_DEFAULT_VOLUME;
+unsigned long provisioningSeq = 0;
+long remoteConfigVersion = 0;
+String remoteConfigETag = "";
+bool shouldRestart = false;
+bool ledControllersStarted = false; // a new LED layout needs a restart from then on
+
+// Takes the layout only if it is complete, a typo in the config must not leave the LEDs dark
+void applyLedLayout(JsonObject doc)
+{
+    LedLayout layout;
+    bool valid = doc["strips"].size() > 0;
+    for (JsonObject strip : doc["strips"].as<JsonArray>())
+    {
+        valid = valid && addLedStrip(layout, strip["pin"] | 0, strip["leds"] | 0);
+    }
+    for (JsonObject segment : doc["segments"].as<JsonArray>())
+    {
+        int role = ledRoleFromName(segment["role"] | "");
+        valid = valid && role >= 0 && addLedSegment(layout, (LedRole)role, segment["strip"] | 0, segment["start"] | 0, segment["length"] | 0, segment["reverse"] | false);
+    }
+    if (!valid)
+    {
+        Serial.println("invalid ledLayout, keeping the current one");
+        return;
+    }
+    ledLayout = layout;
+    // the FastLED controllers can't be changed once added
+    shouldRestart = shouldRestart || ledControllersStarted;
+}
+
+void storeLedLayout(JsonObject doc)
+{
+    JsonArray strips = doc.createNestedArray("strips");
+    for (int i = 0; i < ledLayout.stripCount; i++)
+    {
+        JsonObject strip = strips.createNestedObject();
+        strip["pin"] = ledLayout.strips[i].pin;
+        strip["leds"] = ledLayout.strips[i].count;
+    }
+    JsonArray segments = doc.createNestedArray("segments");
+    for (int i = 0; i < ledLayout.segmentCount; i++)
+    {
+        const LedSegment &s = ledLayout.segments[i];
+        JsonObject segment = segments.createNestedObject();
+        segment["role"] = LED_ROLE_NAMES[s.role];
+        segment["strip"] = s.strip;
+        segment["start"] = s.start;
+        segment["length"] = s.length;
+        segment["reverse"] = s.reverse;
+    }
+}
+
+// The LDR is read with analogRead() while Wi-Fi is on, only ADC1 works then
+bool isLdrPin(int pin)
+{
+    return pin == -1 || (pin >= 32 && pin <= 39);
+}
+
+bool isHour(int hour)
+{
+    return hour >= 0 && hour <= 23;
+}
+
+void applyParams(JsonObject params, bool fromNetwork)
+{
+    if (params.containsKey("influxDBURL"))
+    {
+        strlcpy(influxDBURL, params["influxDBURL"] | "", sizeof(influxDBURL));
+    }
+    if (params.containsKey("influxDBOrg"))
+    {
+        strlcpy(influxDBOrg, params["influxDBOrg"] | "", sizeof(influxDBOrg));
+    }
+    if (params.containsKey("influxDBBucket"))
+    {
+        strlcpy(influxDBBucket, params["influxDBBucket"] | "", sizeof(influxDBBucket));
+    }
+    if (params.containsKey("influxDBToken"))
+    {
+        strlcpy(influxDBToken, params["influxDBToken"] | "", sizeof(influxDBToken));
+    }
+    if (params.containsKey("lastestVersionURL"))
+    {
+        strlcpy(lastestVersionURL, params["lastestVersionURL"] | "", sizeof(lastestVersionURL));
+    }
+    if (params.containsKey("firmwarePath"))
+    {
+        strlcpy(firmwarePath, params["firmwarePath"] | "", sizeof(firmwarePath));
+    }
+    if (params.containsKey("useWifi"))
+    {
+        strlcpy(useWifi, params["useWifi"] | "", sizeof(useWifi));
+    }
+    if (params.containsKey("tempOffsetBME"))
+    {
+        strlcpy(tempOffsetBME, params["tempOffsetBME"] | "", sizeof(tempOffsetBME));
+    }
+    if (params.containsKey("tempModel"))
+    {
+        // Coefficients as printed by tools/fit_temp_compensation.py
+        JsonObject model = params["tempModel"];
+        tempModel.warm = model["warm"] | tempModel.warm;
+        tempModel.tau = model["tau"] | tempModel.tau;
+        tempModel.led = model["led"] | tempModel.led;
+        tempModel.radio = model["radio"] | tempModel.radio;
+        tempModel.mhz = model["mhz"] | tempModel.mhz;
+    }
+    if (!fromNetwork && params.containsKey("provisioningSeq"))
+    {
+        provisioningSeq = params["provisioningSeq"];
+    }
+    if (params.containsKey("remoteConfigURL"))
+    {
+        strlcpy(remoteConfigURL, params["remoteConfigURL"] | "", sizeof(remoteConfigURL));
+    }
+    if (!fromNetwork && params.containsKey("remoteConfigVersion"))
+    {
+        remoteConfigVersion = params["remoteConfigVersion"];
+    }
+    if (!fromNetwork && params.containsKey("remoteConfigETag"))
+    {
+        remoteConfigETag = params["remoteConfigETag"] | "";
+    }
+    if (params.containsKey("measurementInterval"))
+    {
+        measurementInterval = constrain(params["measurementInterval"] | MEASUREMENT_INTERVAL, MIN_MEASUREMENT_INTERVAL, MAX_MEASUREMENT_INTERVAL);
+    }
+    if (params.containsKey("nightStart") && isHour(params["nightStart"] | -1))
+    {
+        brightnessSchedule.nightStart = params["nightStart"];
+    }
+    if (params.containsKey("nightEnd") && isHour(params["nightEnd"] | -1))
+    {
+        brightnessSchedule.nightEnd = params["nightEnd"];
+    }
+    if (params.containsKey("nightBrightness"))
+    {
+        brightnessSchedule.nightBrightness = constrain(params["nightBrightness"] | 255, 0, 255);
+    }
+    if (params.containsKey("ldrPin") && isLdrPin(params["ldrPin"] | -2))
+    {
+        ldrPin = params["ldrPin"];
+    }
+    if (params.containsKey("timeZone"))
+    {
+        strlcpy(timeZone, params["timeZone"] | "", sizeof(timeZone));
+    }
+    if (params.containsKey("ledLayout"))
+    {
+        applyLedLayout(params["ledLayout"]);
+    }
+    if (params.containsKey("roomVolume"))
+    {
+        roomVolume = params["roomVolume"] | ROOM_DEFAULT_VOLUME;
+    }
+    if (params.containsKey("mqttHost"))
+    {
+        strlcpy(mqttHost, params["mqttHost"] | "", sizeof(mqttHost));
+    }
+    if (params.containsKey("mqttPort"))
+    {
+        strlcpy(mqttPort, params["mqttPort"] | "1883", sizeof(mqttPort));
+    }
+    if (params.containsKey("mqttUser"))
+    {
+        strlcpy(mqttUser, params["mqttUser"] | "", sizeof(mqttUser));
+    }
+    if (params.containsKey("mqttPass"))
+    {
+        strlcpy(mqttPass, params["mqttPass"] | "", sizeof(mqttPass));
+    }
+    if (params.containsKey("mqttTopic"))
+    {
+        strlcpy(mqttTopic, params["mqttTopic"] | "", sizeof(mqttTopic));
+    }
+    if (params.containsKey("mqttDiscovery"))
+    {
+        strlcpy(mqttDiscovery, params["mqttDiscovery"] | "", sizeof(mqttDiscovery));
+    }
+    if (params.containsKey("maxMeasurementInterval"))
+    {
+        // set it to measurementInterval to sample at a fixed rate
+        maxMeasurementInterval = constrain(params["maxMeasurementInterval"] | MAX_ADAPTIVE_INTERVAL, MIN_MEASUREMENT_INTERVAL, MAX_MEASUREMENT_INTERVAL);
+    }
+}
+
+#endif
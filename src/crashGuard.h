@@ -0,0 +1,251 @@
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <SPIFFS.h>
+#include <Update.h>
+#include <esp_system.h>
+#include <esp_task_wdt.h>
+#include <esp_idf_version.h>
+
+#ifndef CrashGuard_H_
+#define CrashGuard_H_
+
+/*
+Watchdog, crash-loop detection and safe mode.
+
+loop() does the sampling and all networking, so the task watchdog watches the
+loop task: handleCrashGuard() feeds it, a hang for WATCHDOG_TIMEOUT_S resets the
+device. The timeout covers the blocking Wi-Fi portal (connect + portal timeout).
+
+Which part of the firmware was running is kept in RTC memory (setCrashPhase()),
+it survives every reset but power loss. After a crash the reset reason, the phase
+and the uptime go to /crash.json until they are uploaded. The Arduino core keeps
+no backtrace across a reset without a core dump partition, the phase is the
+breadcrumb instead.
+
+Crashes before STABLE_UPTIME count as early. A firmware that crashes early
+ROLLBACK_CRASHES times before it ever ran stable is rolled back to the previous
+OTA partition and not installed again. After SAFE_MODE_CRASHES early crashes the
+device boots into safe mode: the LEDs and the CO2 sensor keep working, Wi-Fi,
+Influx, updates and provisioning stay off. Safe mode tries a normal boot again
+after SAFE_MODE_DURATION, a power cycle ends it right away. Brownouts are
+reported like crashes but count towards neither, a weak supply is no fault of
+the firmware.
+*/
+
+#define WATCHDOG_TIMEOUT_S 180
+#define STABLE_UPTIME 120000UL       // ms, a crash before this is early
+#define ROLLBACK_CRASHES 2           // early crashes of a new firmware before rolling back
+#define SAFE_MODE_CRASHES 3          // early crashes before booting without networking
+#define SAFE_MODE_DURATION 3600000UL // ms in safe mode before trying a normal boot
+#define CRASH_GUARD_MAGIC 0xC0A2B007
+
+enum CrashPhase : uint8_t
+{
+    PHASE_BOOT,
+    PHASE_WIFI,
+    PHASE_INFLUX,
+    PHASE_SENSOR,
+    PHASE_LOOP,
+    PHASE_UPDATE,
+    PHASE_OTA,
+    PHASE_PORTAL,
+    PHASE_PUBLISH
+};
+
+const char *const CRASH_PHASE_NAMES[] = {"boot", "wifi", "influx", "sensor", "loop", "update", "ota", "portal", "publish"};
+
+RTC_NOINIT_ATTR uint32_t rtcMagic;
+RTC_NOINIT_ATTR uint32_t rtcEarlyCrashes;
+RTC_NOINIT_ATTR uint32_t rtcPhase;
+RTC_NOINIT_ATTR uint32_t rtcUptime; // s
+
+struct CrashReport
+{
+    unsigned long crashes = 0; // since /crash.json was created
+    unsigned long pending = 0; // not uploaded yet
+    unsigned long rollbacks = 0;
+    String lastReason;
+    String lastPhase;
+    unsigned long lastUptime = 0; // s
+    String stableVersion;         // last firmware that ran for STABLE_UPTIME
+    String blockedVersion;        // rolled back, never install again
+};
+
+CrashReport crashReport;
+bool safeMode = false;
+bool bootStable = false;
+
+const char *resetReasonName(esp_reset_reason_t reason)
+{
+    switch (reason)
+    {
+    case ESP_RST_POWERON:
+        return "poweron";
+    case ESP_RST_EXT:
+        return "external";
+    case ESP_RST_SW:
+        return "software";
+    case ESP_RST_PANIC:
+        return "panic";
+    case ESP_RST_INT_WDT:
+        return "interrupt watchdog";
+    case ESP_RST_TASK_WDT:
+        return "task watchdog";
+    case ESP_RST_WDT:
+        return "watchdog";
+    case ESP_RST_DEEPSLEEP:
+        return "deepsleep";
+    case ESP_RST_BROWNOUT:
+        return "brownout";
+    default:
+        return "unknown";
+    }
+}
+
+bool isCrash(esp_reset_reason_t reason)
+{
+    return reason == ESP_RST_PANIC || reason == ESP_RST_INT_WDT || reason == ESP_RST_TASK_WDT ||
+           reason == ESP_RST_WDT;
+}
+
+// Resets that go into the crash report
+bool isReportedReset(esp_reset_reason_t reason)
+{
+    return isCrash(reason) || reason == ESP_RST_BROWNOUT;
+}
+
+void loadCrashReport()
+{
+    File file = SPIFFS.open("/crash.json", "r");
+    if (!file)
+    {
+        return;
+    }
+    DynamicJsonDocument doc(512);
+    if (deserializeJson(doc, file) == DeserializationError::Ok)
+    {
+        crashReport.crashes = doc["crashes"] | 0UL;
+        crashReport.pending = doc["pending"] | 0UL;
+        crashReport.rollbacks = doc["rollbacks"] | 0UL;
+        crashReport.lastReason = doc["lastReason"] | "";
+        crashReport.lastPhase = doc["lastPhase"] | "";
+        crashReport.lastUptime = doc["lastUptime"] | 0UL;
+        crashReport.stableVersion = doc["stableVersion"] | "";
+        crashReport.blockedVersion = doc["blockedVersion"] | "";
+    }
+    file.close();
+}
+
+void storeCrashReport()
+{
+    DynamicJsonDocument doc(512);
+    doc["crashes"] = crashReport.crashes;
+    doc["pending"] = crashReport.pending;
+    doc["rollbacks"] = crashReport.rollbacks;
+    doc["lastReason"] = crashReport.lastReason;
+    doc["lastPhase"] = crashReport.lastPhase;
+    doc["lastUptime"] = crashReport.lastUptime;
+    doc["stableVersion"] = crashReport.stableVersion;
+    doc["blockedVersion"] = crashReport.blockedVersion;
+    File file = SPIFFS.open("/crash.json", "w");
+    if (!file)
+    {
+        Serial.println("failed to open crash report for writing");
+        return;
+    }
+    serializeJson(doc, file);
+    file.close();
+}
+
+inline void setCrashPhase(CrashPhase phase)
+{
+    rtcPhase = phase;
+}
+
+inline void feedWatchdog()
+{
+    esp_task_wdt_reset();
+}
+
+// Call early in setup() with SPIFFS mounted, may roll back and restart
+void beginCrashGuard(const char *version)
+{
+    esp_reset_reason_t reason = esp_reset_reason();
+    if (rtcMagic != CRASH_GUARD_MAGIC || reason == ESP_RST_POWERON)
+    {
+        rtcMagic = CRASH_GUARD_MAGIC;
+        rtcEarlyCrashes = 0;
+        rtcUptime = 0;
+        rtcPhase = PHASE_BOOT;
+    }
+    loadCrashReport();
+
+    if (isReportedReset(reason))
+    {
+        if (isCrash(reason))
+        {
+            // the stable mark resets the counter, every crash before it is early
+            rtcEarlyCrashes++;
+        }
+        crashReport.crashes++;
+        crashReport.pending++;
+        crashReport.lastReason = resetReasonName(reason);
+        crashReport.lastPhase = CRASH_PHASE_NAMES[rtcPhase < sizeof(CRASH_PHASE_NAMES) / sizeof(CRASH_PHASE_NAMES[0]) ? rtcPhase : PHASE_BOOT];
+        crashReport.lastUptime = rtcUptime;
+        Serial.printf("crashed (%s) in %s after %lu s, %u early crashes\n", crashReport.lastReason.c_str(),
+                      crashReport.lastPhase.c_str(), crashReport.lastUptime, (unsigned)rtcEarlyCrashes);
+
+        if (isCrash(reason) && rtcEarlyCrashes >= ROLLBACK_CRASHES && crashReport.stableVersion != "" &&
+            crashReport.stableVersion != version && Update.canRollBack())
+        {
+            Serial.println("new firmware keeps crashing, rolling back");
+            crashReport.rollbacks++;
+            crashReport.blockedVersion = version;
+            storeCrashReport();
+            rtcEarlyCrashes = 0;
+            Update.rollBack();
+            ESP.restart();
+        }
+        storeCrashReport();
+    }
+    rtcPhase = PHASE_BOOT;
+    rtcUptime = 0;
+
+    safeMode = rtcEarlyCrashes >= SAFE_MODE_CRASHES;
+    if (safeMode)
+    {
+        Serial.println("crash loop, booting in safe mode");
+    }
+
+#if ESP_IDF_VERSION_MAJOR >= 5
+    esp_task_wdt_config_t config = {WATCHDOG_TIMEOUT_S * 1000, (1 << portNUM_PROCESSORS) - 1, true};
+    esp_task_wdt_reconfigure(&config);
+#else
+    esp_task_wdt_init(WATCHDOG_TIMEOUT_S, true);
+#endif
+    esp_task_wdt_add(NULL);
+}
+
+// Call from loop()
+void handleCrashGuard(const char *version)
+{
+    feedWatchdog();
+    rtcUptime = millis() / 1000;
+    if (!bootStable && millis() > STABLE_UPTIME && !safeMode)
+    {
+        bootStable = true;
+        rtcEarlyCrashes = 0;
+        if (crashReport.stableVersion != version)
+        {
+            crashReport.stableVersion = version;
+            storeCrashReport();
+        }
+    }
+    if (safeMode && millis() > SAFE_MODE_DURATION)
+    {
+        rtcEarlyCrashes = 0;
+        ESP.restart();
+    }
+}
+
+#endif
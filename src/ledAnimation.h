@@ -0,0 +1,218 @@
+#include <FastLED.h>
+#include "ampelLeds.h"
+#include "ledBrightness.h"
+#include "ledLayout.h"
+
+#ifndef LedAnimation_H_
+#define LedAnimation_H_
+
+/*
+Small animation engine on top of the static scene in leds[].
+
+showCO2()/showTemp()/setPixel() keep writing the scene, composeFrame() renders
+it through the layout (ledLayout.h) plus the active animations into ledFrame[],
+which goes through the brightness stage (ledBrightness.h) to the strips.
+Animations run on a fixed frame clock (FRAMES_PER_SECOND) driven from loop() by
+tickAnimations(); without active animations frames are only pushed when the
+scene changes or the brightness stage is dithering. Phases are derived from the
+time, so a dropped frame never slows an animation down, and all brightness
+curves come from a lookup table built once in initAnimations().
+
+Each frame is timed; if composing and pushing takes FRAME_BUDGET_US longer than
+the strips need on the wire the frame clock is slowed down so the animations can
+never starve the sensor readings in loop(), it speeds up again once frames are
+cheap. FastLED.show() blocks for the wire time as well, so the frame clock never
+runs faster than keeping the strips busy 1/FRAME_WIRE_SHARE of the time. Dithering
+at night pushes frames for hours, a long layout gets fewer of them.
+
+Boot and OTA progress are drawn immediately by their setters since setup() and
+the OTA download block loop().
+*/
+
+#define ANIM_BREATHING 0x01     // whole strip breathes, used for provisioning mode
+#define ANIM_PULSE 0x02         // CO2 LEDs pulse, used above the alarm threshold
+#define ANIM_BOOT_PROGRESS 0x04 // progress bar while booting
+#define ANIM_OTA_PROGRESS 0x08  // progress bar while downloading an update
+
+#define BREATH_PERIOD 4000 // ms
+#define PULSE_PERIOD 1000  // ms
+#define PULSE_FLOOR 64     // pulsing LEDs never get darker than 64/255
+#define FRAME_BUDGET_US 1500
+#define MAX_FRAME_INTERVAL_US 100000
+#define FRAME_WIRE_SHARE 5 // frame interval at least 5x the wire time
+
+CRGB ledFrame[MAX_LEDS];
+uint8_t waveLUT[256]; // 0 .. 255 .. 0 raised cosine over one period
+
+uint8_t activeAnimations = 0;
+uint8_t animationProgress = 0; // 0 .. 255 for the progress bars
+bool sceneChanged = true;
+unsigned long frameIntervalMicros = 1000000UL / FRAMES_PER_SECOND;
+unsigned long minFrameIntervalMicros = 1000000UL / FRAMES_PER_SECOND; // what the layout can sustain
+unsigned long lastFrameMicros = 0;
+unsigned long lastFrameDuration = 0; // us, compose + push
+unsigned long frameWireMicros = 0; // push time of the layout, not part of the budget
+unsigned long droppedFrames = 0;
+
+void initAnimations()
+{
+    frameWireMicros = layoutWireMicros(ledLayout);
+    minFrameIntervalMicros = frameWireMicros * FRAME_WIRE_SHARE;
+    if (minFrameIntervalMicros < 1000000UL / FRAMES_PER_SECOND)
+    {
+        minFrameIntervalMicros = 1000000UL / FRAMES_PER_SECOND;
+    }
+    frameIntervalMicros = minFrameIntervalMicros;
+    for (int i = 0; i < 256; i++)
+    {
+        waveLUT[i] = (uint8_t)(127.5f - 127.5f * cosf(i * 2.0f * (float)M_PI / 256.0f) + 0.5f);
+    }
+}
+
+// Index into waveLUT for the current time, integer only
+inline uint8_t wavePhase(unsigned long nowMillis, unsigned long period)
+{
+    return (uint8_t)((nowMillis % period) * 256 / period);
+}
+
+// Every strip shows the whole bar
+void drawProgress(const CRGB &color)
+{
+    for (int i = 0; i < ledLayout.totalLeds; i++)
+    {
+        ledFrame[i] = color;
+    }
+    for (int s = 0; s < ledLayout.stripCount; s++)
+    {
+        const LedStrip &strip = ledLayout.strips[s];
+        maskBar(ledFrame + strip.offset, strip.count, animationProgress, gReverseDirection);
+    }
+}
+
+void composeFrame(unsigned long nowMillis)
+{
+    if (activeAnimations & ANIM_OTA_PROGRESS)
+    {
+        drawProgress(green[1]);
+        return;
+    }
+    if (activeAnimations & ANIM_BOOT_PROGRESS)
+    {
+        drawProgress(blue[1]);
+        return;
+    }
+
+    renderLayout(ledLayout, ledFrame);
+    if (activeAnimations & ANIM_PULSE)
+    {
+        uint8_t level = PULSE_FLOOR + scale8u(waveLUT[wavePhase(nowMillis, PULSE_PERIOD)], 255 - PULSE_FLOOR);
+        for (int s = 0; s < ledLayout.segmentCount; s++)
+        {
+            const LedSegment &segment = ledLayout.segments[s];
+            if (!isCO2Role(segment.role))
+            {
+                continue;
+            }
+            CRGB *target = ledFrame + ledLayout.strips[segment.strip].offset + segment.start;
+            for (int i = 0; i < segment.length; i++)
+            {
+                target[i] = scaleColor(target[i], level);
+            }
+        }
+    }
+    if (activeAnimations & ANIM_BREATHING)
+    {
+        // breathe in cyan over the scene so the readings stay visible
+        uint8_t level = waveLUT[wavePhase(nowMillis, BREATH_PERIOD)];
+        CRGB glow = scaleColor(cyan[0], level);
+        for (int i = 0; i < ledLayout.totalLeds; i++)
+        {
+            ledFrame[i] = CRGB(qadd8(ledFrame[i].r, glow.r), qadd8(ledFrame[i].g, glow.g), qadd8(ledFrame[i].b, glow.b));
+        }
+    }
+}
+
+void pushFrame()
+{
+    unsigned long start = micros();
+    composeFrame(millis());
+    applyBrightness(ledFrame, ledOutput, ledLayout.totalLeds, start);
+    FastLED.show();
+    lastFrameDuration = micros() - start;
+    lastFrameMicros = start;
+    sceneChanged = false;
+}
+
+// Call after changing leds[], the frame is pushed with the next tick
+void showScene()
+{
+    sceneChanged = true;
+}
+
+void setAnimation(uint8_t animation, bool enabled)
+{
+    uint8_t previous = activeAnimations;
+    activeAnimations = enabled ? activeAnimations | animation : activeAnimations & ~animation;
+    if (previous != activeAnimations)
+    {
+        sceneChanged = true; // make sure the final frame of a stopped animation is replaced
+    }
+}
+
+void setBootProgress(uint8_t step, uint8_t steps)
+{
+    animationProgress = step >= steps ? 255 : step * 255 / steps;
+    setAnimation(ANIM_BOOT_PROGRESS, step < steps);
+    pushFrame();
+}
+
+void setOTAProgress(size_t done, size_t total)
+{
+    animationProgress = total == 0 ? 0 : (uint64_t)done * 255 / total;
+    setAnimation(ANIM_OTA_PROGRESS, done < total);
+    // the OTA download reports every few hundred bytes, keep the strip traffic down
+    if (micros() - lastFrameMicros >= frameIntervalMicros || done >= total)
+    {
+        pushFrame();
+    }
+}
+
+// Call from loop(), pushes a frame when the frame clock is due
+void tickAnimations()
+{
+    unsigned long now = micros();
+    if (activeAnimations == 0 && !isDithering())
+    {
+        if (sceneChanged)
+        {
+            pushFrame();
+        }
+        return;
+    }
+    if (now - lastFrameMicros < frameIntervalMicros)
+    {
+        return;
+    }
+    if (now - lastFrameMicros >= 2 * frameIntervalMicros)
+    {
+        droppedFrames += (now - lastFrameMicros) / frameIntervalMicros - 1;
+    }
+
+    pushFrame();
+
+    // hard budget: halve the frame rate when a frame gets too expensive, recover slowly
+    if (lastFrameDuration > frameWireMicros + FRAME_BUDGET_US && frameIntervalMicros < MAX_FRAME_INTERVAL_US)
+    {
+        frameIntervalMicros *= 2;
+    }
+    else if (lastFrameDuration < frameWireMicros + FRAME_BUDGET_US / 2 && frameIntervalMicros > minFrameIntervalMicros)
+    {
+        frameIntervalMicros -= frameIntervalMicros / 8;
+        if (frameIntervalMicros < minFrameIntervalMicros)
+        {
+            frameIntervalMicros = minFrameIntervalMicros;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,150 @@
+#include <FastLED.h>
+#include "ampelLeds.h"
+#include "ledLayout.h"
+
+#ifndef LedBrightness_H_
+#define LedBrightness_H_
+
+/*
+Global brightness applied once at frame output, the palettes in defineColors()
+stay untouched.
+
+globalBrightness is perceptual (0 .. 255) and mapped through a gamma 2.2 table
+to the linear output scale, so halving it looks half as bright. Scaling the dim
+palette values (green[0] is 20) would lose most of the steps, therefore the
+fraction that doesn't fit in 8 bit is carried over per channel to the next frame
+(temporal dithering); on average every LED gets exactly value * scale / 256.
+
+The brightness comes from a night schedule and optionally an LDR on an ADC1 pin,
+the darker of both wins. The estimated LED current is integrated over time so
+main can publish the average per measurement.
+*/
+
+#define BRIGHTNESS_GAMMA 2.2f
+#define LED_CHANNEL_MA 20.0f // WS2811 channel at full duty
+#define LED_IDLE_MA 0.7f     // WS2811 chip with all channels off
+#define LDR_MIN_BRIGHTNESS 48 // never darker than this in a dark room, perceptual
+#define LDR_ALPHA 0.1f
+
+struct BrightnessSchedule
+{
+    int nightStart = 20; // hour, local time
+    int nightEnd = 6;    // hour, equal to nightStart disables the schedule
+    uint8_t nightBrightness = 64;
+};
+
+BrightnessSchedule brightnessSchedule;
+int ldrPin = -1; // ADC1 pin with an LDR to 3.3 V and a resistor to GND, -1 without
+float ldrLevel = NAN; // smoothed 0.0 (dark) .. 1.0 (bright)
+
+CRGB ledOutput[MAX_LEDS]; // what FastLED pushes to the strip
+uint8_t gammaLUT[256];
+uint8_t globalBrightness = 255;
+uint8_t outputScale = 255;
+uint8_t ditherResidual[MAX_LEDS][3];
+
+float ledCurrentNow = 0.0f; // mA of the frame on the strip
+double ledCharge = 0.0;     // mA * us since the last average
+unsigned long ledChargeSince = 0;
+unsigned long ledChargeLast = 0;
+
+void initBrightness()
+{
+    for (int i = 0; i < 256; i++)
+    {
+        gammaLUT[i] = (uint8_t)(255.0f * powf(i / 255.0f, BRIGHTNESS_GAMMA) + 0.5f);
+    }
+    // a very dim but non zero brightness must not end up completely dark
+    for (int i = 1; i < 256 && gammaLUT[i] == 0; i++)
+    {
+        gammaLUT[i] = 1;
+    }
+}
+
+void setGlobalBrightness(uint8_t brightness)
+{
+    globalBrightness = brightness;
+    outputScale = gammaLUT[brightness];
+}
+
+// Partial scales need a frame every tick for the dithering to average out
+inline bool isDithering()
+{
+    return outputScale != 255 && outputScale != 0;
+}
+
+inline uint8_t ditherChannel(uint8_t value, uint8_t &residual)
+{
+    uint16_t scaled = (uint16_t)value * outputScale + residual;
+    residual = scaled & 0xFF;
+    return scaled >> 8;
+}
+
+void applyBrightness(const CRGB *in, CRGB *out, int count, unsigned long nowMicros)
+{
+    uint32_t sum = 0;
+    if (outputScale == 255)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            out[i] = in[i];
+            sum += in[i].r + in[i].g + in[i].b;
+        }
+    }
+    else
+    {
+        for (int i = 0; i < count; i++)
+        {
+            out[i] = CRGB(ditherChannel(in[i].r, ditherResidual[i][0]),
+                          ditherChannel(in[i].g, ditherResidual[i][1]),
+                          ditherChannel(in[i].b, ditherResidual[i][2]));
+            sum += out[i].r + out[i].g + out[i].b;
+        }
+    }
+
+    // the previous frame was on the strip until now
+    if (ledChargeLast != 0)
+    {
+        ledCharge += ledCurrentNow * (double)(nowMicros - ledChargeLast);
+    }
+    else
+    {
+        ledChargeSince = nowMicros;
+    }
+    ledChargeLast = nowMicros;
+    ledCurrentNow = sum * LED_CHANNEL_MA / 255.0f + count * LED_IDLE_MA;
+}
+
+// Average LED current in mA since the last call
+float averageLedCurrent(unsigned long nowMicros)
+{
+    ledCharge += ledCurrentNow * (double)(nowMicros - ledChargeLast);
+    ledChargeLast = nowMicros;
+    unsigned long elapsed = nowMicros - ledChargeSince;
+    float average = elapsed > 0 ? ledCharge / elapsed : ledCurrentNow;
+    ledCharge = 0.0;
+    ledChargeSince = nowMicros;
+    return average;
+}
+
+uint8_t scheduledBrightness(int hour)
+{
+    const BrightnessSchedule &s = brightnessSchedule;
+    if (hour < 0 || s.nightStart == s.nightEnd)
+    {
+        return 255; // no time yet or no schedule
+    }
+    bool night = s.nightStart < s.nightEnd ? hour >= s.nightStart && hour < s.nightEnd
+                                           : hour >= s.nightStart || hour < s.nightEnd;
+    return night ? s.nightBrightness : 255;
+}
+
+// raw ADC reading 0 .. 4095
+uint8_t ambientBrightness(int raw)
+{
+    float level = raw / 4095.0f;
+    ldrLevel = isnan(ldrLevel) ? level : ldrLevel + LDR_ALPHA * (level - ldrLevel);
+    return LDR_MIN_BRIGHTNESS + (uint8_t)((255 - LDR_MIN_BRIGHTNESS) * ldrLevel);
+}
+
+#endif
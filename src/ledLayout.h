@@ -0,0 +1,212 @@
+#include <FastLED.h>
+#include <string.h>
+#include "ampelLeds.h"
+
+#ifndef LedLayout_H_
+#define LedLayout_H_
+
+/*
+Maps the scene in leds[] (0-3 temperature, 4 status, 5-7 CO2) onto the strips.
+
+A layout is a list of strips (data pin, LED count) and segments, each showing one
+role on a range of one strip. The scene LEDs of a role are stretched over the
+range of its segment, LED_ROLE_CO2_BAR instead draws a bar graph of the last CO2
+reading so a 30 or 60 LED bar gets a finer scale than the three CO2 LEDs.
+
+The strips lie back to back in ledFrame[]/ledOutput[] and each one gets its own
+FastLED controller. The RMT driver of the ESP32 sends all strips at the same
+time, so a frame takes as long as the longest strip, not as all LEDs together.
+Without a "ledLayout" in the config the single 8 LED strip on LED_PIN is used.
+*/
+
+#define MAX_LEDS 240
+#define MAX_STRIPS 4
+#define MAX_SEGMENTS 8
+#define CO2_BAR_MIN 400.0f  // ppm, empty bar
+#define CO2_BAR_MAX 3000.0f // ppm, full bar
+#define LED_WIRE_US 30      // WS2811 at 800 kHz, 24 bit per LED
+#define LED_RESET_US 50
+
+// Output pins a strip may use, main.cpp has a FastLED controller for each.
+// 16/17 are the sensor UART, 21/22 I2C, 0 the setup button and 12 a strapping pin.
+const uint8_t LED_PINS[] = {2, 4, 5, 13, 14, 15, 18, 19, 23, 25, 26, 27, 32, 33};
+
+enum LedRole : uint8_t
+{
+    LED_ROLE_TEMP,
+    LED_ROLE_STATUS,
+    LED_ROLE_CO2,
+    LED_ROLE_CO2_BAR,
+    LED_ROLE_SCENE // all 8 scene LEDs, e.g. a second strip mirroring the first
+};
+
+const char *const LED_ROLE_NAMES[] = {"temp", "status", "co2", "co2bar", "scene"};
+const uint8_t ROLE_FIRST[] = {0, 4, 5, 0, 0}; // scene LEDs of each role
+const uint8_t ROLE_COUNT[] = {4, 1, 3, 0, NUM_LEDS};
+
+struct LedStrip
+{
+    uint8_t pin;
+    uint16_t count;
+    uint16_t offset; // first LED in ledFrame[]/ledOutput[]
+};
+
+struct LedSegment
+{
+    LedRole role;
+    uint8_t strip;
+    uint16_t start;
+    uint16_t length;
+    bool reverse;
+};
+
+struct LedLayout
+{
+    LedStrip strips[MAX_STRIPS];
+    uint8_t stripCount = 0;
+    LedSegment segments[MAX_SEGMENTS];
+    uint8_t segmentCount = 0;
+    uint16_t totalLeds = 0;
+};
+
+LedLayout ledLayout;
+
+// (v * scale) / 256 without division, scale 255 keeps v
+inline uint8_t scale8u(uint8_t v, uint8_t scale)
+{
+    return ((uint16_t)v * (uint16_t)(scale + 1)) >> 8;
+}
+
+inline CRGB scaleColor(const CRGB &c, uint8_t scale)
+{
+    return CRGB(scale8u(c.r, scale), scale8u(c.g, scale), scale8u(c.b, scale));
+}
+
+// -1 for unknown names
+int ledRoleFromName(const char *name)
+{
+    for (int i = 0; i <= LED_ROLE_SCENE; i++)
+    {
+        if (strcmp(name, LED_ROLE_NAMES[i]) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool addLedStrip(LedLayout &layout, uint8_t pin, uint16_t count)
+{
+    bool pinOK = false;
+    for (uint8_t p : LED_PINS)
+    {
+        pinOK = pinOK || p == pin;
+    }
+    for (int i = 0; i < layout.stripCount; i++)
+    {
+        pinOK = pinOK && layout.strips[i].pin != pin;
+    }
+    if (!pinOK || count == 0 || layout.stripCount >= MAX_STRIPS || layout.totalLeds + count > MAX_LEDS)
+    {
+        return false;
+    }
+    layout.strips[layout.stripCount++] = {pin, count, layout.totalLeds};
+    layout.totalLeds += count;
+    return true;
+}
+
+bool addLedSegment(LedLayout &layout, LedRole role, uint8_t strip, uint16_t start, uint16_t length, bool reverse)
+{
+    if (strip >= layout.stripCount || length == 0 || start + length > layout.strips[strip].count || layout.segmentCount >= MAX_SEGMENTS)
+    {
+        return false;
+    }
+    layout.segments[layout.segmentCount++] = {role, strip, start, length, reverse};
+    return true;
+}
+
+void defaultLedLayout(LedLayout &layout)
+{
+    layout = LedLayout();
+    addLedStrip(layout, LED_PIN, NUM_LEDS);
+    addLedSegment(layout, LED_ROLE_TEMP, 0, 0, 4, false);
+    addLedSegment(layout, LED_ROLE_STATUS, 0, 4, 1, false);
+    addLedSegment(layout, LED_ROLE_CO2, 0, 5, 3, false);
+}
+
+// Time the strips need for one frame, they are sent in parallel
+unsigned long layoutWireMicros(const LedLayout &layout)
+{
+    uint16_t longest = 0;
+    for (int i = 0; i < layout.stripCount; i++)
+    {
+        longest = layout.strips[i].count > longest ? layout.strips[i].count : longest;
+    }
+    return (unsigned long)longest * LED_WIRE_US + LED_RESET_US;
+}
+
+inline bool isCO2Role(LedRole role)
+{
+    return role == LED_ROLE_CO2 || role == LED_ROLE_CO2_BAR;
+}
+
+// Keeps level/255 of the count LEDs lit, dims the LED at the edge by the fraction and clears the rest
+void maskBar(CRGB *frame, int count, uint8_t level, bool reverse)
+{
+    uint32_t position = (uint32_t)level * count;
+    for (int i = 0; i < count; i++)
+    {
+        CRGB &led = frame[reverse ? count - 1 - i : i];
+        uint32_t ledStart = i * 255;
+        if (position <= ledStart)
+        {
+            led = CRGB(0, 0, 0);
+        }
+        else if (position < ledStart + 255)
+        {
+            led = scaleColor(led, position - ledStart);
+        }
+    }
+}
+
+// Same steps as showCO2(), one palette level lower since a bar lights many LEDs
+const CRGB &co2BarColor(float ppm)
+{
+    return ppm < 1000.0f ? green[1] : ppm < 1400.0f ? yellow[1] : ppm < 2000.0f ? orange[1] : red[1];
+}
+
+void drawCO2Bar(CRGB *frame, int count, bool reverse)
+{
+    for (int i = 0; i < count; i++)
+    {
+        frame[reverse ? count - 1 - i : i] = co2BarColor(CO2_BAR_MIN + (i + 0.5f) * (CO2_BAR_MAX - CO2_BAR_MIN) / count);
+    }
+    float fill = (scenePPM - CO2_BAR_MIN) / (CO2_BAR_MAX - CO2_BAR_MIN);
+    maskBar(frame, count, isnan(fill) || fill < 0.0f ? 0 : fill > 1.0f ? 255 : (uint8_t)(fill * 255.0f), reverse);
+}
+
+// Renders the scene in leds[] into frame, which holds layout.totalLeds LEDs
+void renderLayout(const LedLayout &layout, CRGB *frame)
+{
+    for (int i = 0; i < layout.totalLeds; i++)
+    {
+        frame[i] = CRGB(0, 0, 0);
+    }
+    for (int s = 0; s < layout.segmentCount; s++)
+    {
+        const LedSegment &segment = layout.segments[s];
+        CRGB *target = frame + layout.strips[segment.strip].offset + segment.start;
+        if (segment.role == LED_ROLE_CO2_BAR)
+        {
+            drawCO2Bar(target, segment.length, segment.reverse);
+            continue;
+        }
+        for (int i = 0; i < segment.length; i++)
+        {
+            int scene = ROLE_FIRST[segment.role] + i * ROLE_COUNT[segment.role] / segment.length;
+            target[segment.reverse ? segment.length - 1 - i : i] = leds[scene];
+        }
+    }
+}
+
+#endif
@@ -7,10 +7,27 @@
 #include <Update.h>
 #include "Version.h"
 
-#include "MHZ19.h"
+#include "sensorMHZ19.h"
+#include "sensorS8.h"
+#include "sensorSCD30.h"
+#include "sensorSCD4x.h"
 #include <InfluxDbClient.h>
 #include "FastLED.h"
 #include "ampelLeds.h"
+#include "ledAnimation.h"
+#include "ledLayout.h"
+#include "tempCompensation.h"
+#include "config.h"
+#include "provisioning.h"
+#include "adaptiveSampler.h"
+#include "roomAnalytics.h"
+#include "co2Forecast.h"
+#include "sensorHealth.h"
+#include "sampleWindow.h"
+#include "crashGuard.h"
+#include "wifiConnection.h"
+#include "publisher.h"
+#include "mqttPublisher.h"
 #include <sstream>
 #include <EEPROM.h>
 #include <Wire.h>
@@ -25,16 +42,8 @@
 #define START_SETUP_PIN 0
 
 bool isWiFiOK = false;
-char influxDBURL[40] = "";
-char influxDBOrg[32] = "";
-char influxDBBucket[32] = "";
-char influxDBToken[128] = "";
-char lastestVersionURL[60] = "";
-char firmwarePath[60] = "";
-char useWifi[2] = "1";
 bool shouldShowPortal = false;
 bool portalRunning = false;
-char tempOffsetBME[5] = "-3.0";
 
 WiFiManager wm;
 WiFiManagerParameter influxDBURLParam("influxDBURLID", "Influx DB URL");
@@ -43,21 +52,38 @@ WiFiManagerParameter influxDBBucketParam("influxDBBucketID", "Influx DB Bucket")
 WiFiManagerParameter influxDBTokenParam("influxDBTokenID", "Influx DB Token");
 WiFiManagerParameter lastestVersionURLParam("lastestVersionURLID", "URL with string of last version number");
 WiFiManagerParameter firmwarePathParam("firmwarePathID", "Urlpath of firmware.bin");
+WiFiManagerParameter remoteConfigURLParam("remoteConfigURLID", "URL of device config ({chipId} is replaced)");
 WiFiManagerParameter useWifiParam("useWifiID", "Use Wifi 1/0", useWifi, 2);
 WiFiManagerParameter tempOffsetBMEParam("tempOffsetBME", "Temperature offset for BME", tempOffsetBME, 5);
+WiFiManagerParameter mqttHostParam("mqttHostID", "MQTT broker (empty: off)");
+WiFiManagerParameter mqttPortParam("mqttPortID", "MQTT port", mqttPort, 6);
+WiFiManagerParameter mqttUserParam("mqttUserID", "MQTT user");
+WiFiManagerParameter mqttPassParam("mqttPassID", "MQTT password");
 WiFiManagerParameter calibrateNowParam("calibrateNow", "Calibrate MH-Z19B now to 400 ppm", "0", 2);
 
 
-/* MH Z19B */
+/* CO2 sensor (MH-Z19B/C or SenseAir S8 on UART2, SCD30 or SCD4x on I2C) */
 #define RX_PIN 16
 #define TX_PIN 17
-#define BAUDRATE 9600 // Native to the sensor (do not change)
-#define MEASUREMENT_INTERVAL 10000
-MHZ19 myMHZ19;
+#define BAUDRATE 9600 // Native to the UART sensors (do not change)
 HardwareSerial mySerial(2);
+MHZ19Sensor mhz19Sensor(mySerial);
+S8Sensor s8Sensor(mySerial);
+SCD30Sensor scd30Sensor(Wire);
+SCD4xSensor scd4xSensor(Wire);
+// Probed in this order at boot, I2C first as probing there is cheap. The MH-Z19
+// goes before the S8 so the installed units never see a Modbus frame first.
+CO2Sensor *const co2SensorCandidates[] = {&scd4xSensor, &scd30Sensor, &mhz19Sensor, &s8Sensor};
+CO2Sensor *co2Sensor = nullptr;
+SensorReading co2Reading;
+bool hasNewReading = false;
 unsigned long getDataTimer = 0;
+AdaptiveSampler sampler;
+RoomAnalytics room;
+CO2Forecast forecast;
+SensorHealth health;
 int lastCO2 = 0;
-bool MHZ19OK = false;
+bool co2SensorOK = false;
 unsigned long lastSuccessfulWriteTimer = 0;
 unsigned long readCount = 0;
 
@@ -66,6 +92,10 @@ InfluxDBClient client;
 Point sensor("Environment");
 bool shouldWriteToInflux = false;
 
+/* MQTT */
+WiFiClient mqttNet;
+MqttPublisher mqtt(mqttNet);
+
 /* BME280 */
 // Temperature compensation for the setup
 // #define TEMP_COMPENSATION -3.0f
@@ -73,6 +103,7 @@ bool shouldWriteToInflux = false;
 #define ALTITUDE 277.0f
 Adafruit_BME280 bme;
 bool bmeOK = false;
+float lastStaticTemp = NAN; // BME280 with only tempOffsetBME applied, what the self-heating model is fitted on
 
 /* miscellaneous */
 String chipId = "";
@@ -88,11 +119,7 @@ unsigned int checkCount = 0;
 unsigned long timeWithReadingAbove400 = 0;
 unsigned long timeWithReadingBelow500 = 0;
 
-unsigned int sampleCounter = 0;
-#define SAMPLE_SIZE 30
-float samples[SAMPLE_SIZE];
-unsigned int s1DiffBelowThresholdCount = 0;
-// float diffs[SAMPLE_SIZE];
+SampleWindow sampleWindow;
 
 void setChipId()
 {
@@ -206,6 +233,12 @@ void processOTAUpdate()
                 return;
               }
               Serial.println("Will begin OTA Update");
+              setCrashPhase(PHASE_OTA);
+              Update.onProgress([](size_t done, size_t total)
+                                {
+                                  feedWatchdog();
+                                  setOTAProgress(done, total);
+                                });
               Client &client = https.getStream();
               int written = Update.writeStream(client);
               if (written != contentLength)
@@ -257,26 +290,240 @@ void processOTAUpdate()
   }
 }
 
+// Crashes since the last upload go through the publish queue like any point, so
+// every backend gets them. pending is cleared once a backend confirmed the point.
+bool crashReportQueued = false;
+uint32_t crashReportSeq = 0;
+
+void publishCrashReport()
+{
+  if (crashReport.pending == 0 || publishQueue.publisherCount == 0)
+  {
+    return;
+  }
+  if (crashReportQueued)
+  {
+    if (publishQueue.end - crashReportSeq > PUBLISH_QUEUE_SIZE)
+    {
+      // dropped unconfirmed (or confirmed just before), at worst it is sent twice
+      crashReportQueued = false;
+      return;
+    }
+    for (int i = 0; i < publishQueue.publisherCount; i++)
+    {
+      if (publishQueue.publishers[i]->acked > crashReportSeq)
+      {
+        crashReport.pending = 0;
+        crashReportQueued = false;
+        storeCrashReport();
+        return;
+      }
+    }
+    return;
+  }
+  Point crash("Crash");
+  crash.addTag("device", deviceName + chipId);
+  crash.addTag("version", VERSION);
+  crash.addField("crashes", crashReport.crashes);
+  crash.addField("pending", crashReport.pending);
+  crash.addField("rollbacks", crashReport.rollbacks);
+  crash.addField("resetReason", crashReport.lastReason);
+  crash.addField("phase", crashReport.lastPhase);
+  crash.addField("uptime", crashReport.lastUptime);
+  crash.addField("safeMode", safeMode);
+  crashReportSeq = publishQueue.end;
+  crashReportQueued = true;
+  enqueuePoint(crash.toLineProtocol().c_str());
+}
+
+// Influx backend of the publisher queue, one HTTP write per point
+class InfluxPublisher : public Publisher
+{
+public:
+  const char *name() const override { return "influx"; }
+
+  bool ready() override
+  {
+    return isWiFiOK && shouldWriteToInflux;
+  }
+
+  bool send(const std::string &line, uint32_t seq) override
+  {
+    String record = line.c_str();
+    if (!client.writeRecord(record))
+    {
+      return false;
+    }
+    acked = seq + 1;
+    lastSuccessfulWriteTimer = millis();
+    return true;
+  }
+};
+
+InfluxPublisher influx;
+
+void configureMqtt()
+{
+  String topic = strcmp(mqttTopic, "") != 0 ? String(mqttTopic) : "co2ampel/" + chipId;
+  mqtt.configure(mqttHost, atoi(mqttPort), mqttUser, mqttPass, topic.c_str(), mqttDiscovery, ("co2ampel_" + chipId).c_str(),
+                 (deviceName + chipId).c_str(), VERSION);
+}
+
+// The drift history has to survive restarts, it is stored with every health record
+void loadSensorHealth()
+{
+  File file = SPIFFS.open("/health.json", "r");
+  if (!file)
+  {
+    return;
+  }
+  DynamicJsonDocument doc(1024);
+  if (deserializeJson(doc, file) == DeserializationError::Ok)
+  {
+    for (JsonVariant baseline : doc["baselines"].as<JsonArray>())
+    {
+      addBaseline(health, baseline.as<float>());
+    }
+    health.dayMin = doc["dayMin"] | NAN;
+    health.dayStart = millis() - (doc["dayElapsed"] | 0UL);
+    health.calibrations = doc["calibrations"] | 0UL;
+    health.tempMean = doc["tempMean"] | NAN;
+    health.tempPeriods = doc["tempPeriods"] | 0UL;
+  }
+  file.close();
+}
+
+void storeSensorHealth()
+{
+  DynamicJsonDocument doc(1024);
+  JsonArray baselines = doc.createNestedArray("baselines");
+  for (int i = 0; i < health.baselineCount; i++)
+  {
+    baselines.add(health.baselines[i]);
+  }
+  if (!isnan(health.dayMin))
+  {
+    doc["dayMin"] = health.dayMin;
+  }
+  doc["dayElapsed"] = millis() - health.dayStart;
+  doc["calibrations"] = health.calibrations;
+  if (!isnan(health.tempMean))
+  {
+    // frozen during a temperature fault, so a reboot doesn't take the faulty offset as normal
+    doc["tempMean"] = health.tempMean;
+  }
+  doc["tempPeriods"] = health.tempPeriods;
+  File file = SPIFFS.open("/health.json", "w");
+  if (!file)
+  {
+    Serial.println("failed to open sensor health for writing");
+    return;
+  }
+  serializeJson(doc, file);
+  file.close();
+}
+
+// One compact record per hour, status is the worst finding
+void publishHealth()
+{
+  const HealthRecord &record = health.record;
+  Serial.printf("sensor health: %s, %lu/%lu requests failed, %lu invalid, %lu jumps, stuck %lu min\n", record.status,
+                record.failures, record.transactions, record.invalid, record.jumps, record.stuckMinutes);
+  if (publishQueue.publisherCount == 0)
+  {
+    return;
+  }
+  Point point("Health");
+  point.addTag("device", deviceName + chipId);
+  point.addTag("co2Sensor", co2Sensor->name());
+  point.addTag("version", VERSION);
+  point.addField("status", record.status);
+  point.addField("requests", record.transactions);
+  point.addField("failedRequests", record.failures);
+  point.addField("errorRate", record.errorRate);
+  point.addField("readings", record.readings);
+  point.addField("invalid", record.invalid);
+  point.addField("jumps", record.jumps);
+  point.addField("stuckMinutes", record.stuckMinutes);
+  point.addField("calibrations", record.calibrations);
+  if (!isnan(record.tempOffset))
+  {
+    point.addField("tempOffset", record.tempOffset);
+  }
+  if (!isnan(record.tempDeviation))
+  {
+    point.addField("tempDeviation", record.tempDeviation);
+  }
+  point.addField("baselineDays", record.baselineDays);
+  if (!isnan(record.baseline))
+  {
+    point.addField("baselinePPM", record.baseline);
+    point.addField("driftPPM", record.drift);
+    point.addField("driftSlope", record.driftSlope);
+    point.addField("driftScore", record.driftScore);
+  }
+  if (time(nullptr) > 1600000000)
+  {
+    point.setTime((unsigned long long)time(nullptr));
+  }
+  enqueuePoint(point.toLineProtocol().c_str());
+}
+
+void updateSamplerBounds()
+{
+  // never ask the sensor more often than it measures
+  unsigned long minInterval = measurementInterval;
+  if (co2Sensor != nullptr && co2Sensor->measurementPeriod() > minInterval)
+  {
+    minInterval = co2Sensor->measurementPeriod();
+  }
+  setSamplerBounds(sampler, minInterval, maxMeasurementInterval);
+}
+
 void readCO2()
 {
-  if (MHZ19OK)
+  if (co2Sensor != nullptr && hasNewReading)
   {
+    hasNewReading = false;
+    float CO2 = co2Reading.co2;
+    // Only the MH-Z19 heats up itself, the SCD30/SCD4x report ambient temperature
+    float mhzTemp = co2Sensor == &mhz19Sensor ? co2Reading.temperature : NAN;
+
+    // The MH-Z19 term uses the previous reading, the current one depends on the compensation
+    updateSelfHeatingInputs(frameDuty(ledOutput, ledLayout.totalLeds), WiFi.status() == WL_CONNECTED, millis());
+    float selfHeating = predictSelfHeating(tempModel, millis() / 1000.0f, mhzTemp, lastStaticTemp);
+    if (bmeOK)
+    {
+      bme.setTemperatureCompensation(atof(tempOffsetBME) - selfHeating);
+    }
+
     // bme.takeForcedMeasurement();
     float temp = bme.readTemperature();
     float tempCompensation = bme.getTemperatureCompensation();
-
-    float CO2;
-    CO2 = myMHZ19.getCO2(); // Request CO2 (as ppm)
-    float mhzTemp = myMHZ19.getTemperature();
     readCount++;
+    updateSensorHealth(health, CO2, co2Reading.temperature, bmeOK ? temp : NAN, millis());
     if (CO2 > 0.0f && !(readCount <= 4 && CO2 > 1400)) // reading is sometimes zero or too high on the first readings -> don't publish obviously wrong values
     {
       showCO2(CO2);
+      setAnimation(ANIM_PULSE, CO2 >= CO2_ALARM_PPM);
       if (bmeOK)
       {
         showTemp(temp);
       }
-      FastLED.show();
+      else if (co2Sensor->hasCapability(SENSOR_CAP_HUMIDITY))
+      {
+        // sensors with a humidity output measure ambient temperature
+        showTemp(co2Reading.temperature);
+      }
+      room.volume = roomVolume;
+      updateRoomAnalytics(room, CO2, millis());
+      updateForecast(forecast, CO2, millis());
+      if (co2SensorOK)
+      {
+        // status LED turns blue while the windows are open and yellow if they should be opened soon
+        setPixel(4, safeMode ? orange[0] : room.ventilating ? blue[0] : forecast.warn ? yellow[0] : green[0]);
+      }
+      showScene();
 
       Serial.print("CO2 (ppm): ");
       Serial.println(CO2);
@@ -291,98 +538,173 @@ void readCO2()
       {
         timeWithReadingBelow500 = millis();
       }
-      if (millis() - timeWithReadingAbove400 > 600000)
+      // sensors with a working ABC of their own are left alone
+      bool firmwareCalibration = co2Sensor->hasCapability(SENSOR_CAP_FIRMWARE_CALIBRATION);
+      if (firmwareCalibration && millis() - timeWithReadingAbove400 > 600000)
       {
         // All readings in the last 10 Minutes have been below 400 -> calibrate
         Serial.println("Calibrating ..");
-        myMHZ19.calibrate();
-      }
-      samples[sampleCounter % SAMPLE_SIZE] = CO2;
-      float ssDiff = 0;
-      float s1Diff = 0;
-      // float s2Diff = 0;
-      // float s3Diff = 0;
-      // float s4Diff = 0;
-      // float s5Diff = 0;
-
-      if (readCount >= SAMPLE_SIZE)
-      {
-        ssDiff = samples[sampleCounter] - samples[(sampleCounter + 1) % SAMPLE_SIZE];
-        if (CO2_LIGHT_DEBUG)
-        {
-          Serial.print("ssDiff: ");
-          Serial.println(ssDiff);
-        }
+        co2Sensor->calibrate(400);
+        noteSensorCalibration(health, millis());
+        timeWithReadingAbove400 = millis();
       }
-      if (readCount > SAMPLE_SIZE / 5)
+      if (addSample(sampleWindow, CO2, readCount) && firmwareCalibration && millis() - timeWithReadingBelow500 > 14400000)
       {
-        s1Diff = samples[sampleCounter] - samples[(sampleCounter - SAMPLE_SIZE / 5) % SAMPLE_SIZE];
-        if (s1Diff < -15)
-        {
-          s1DiffBelowThresholdCount++;
-        }
-        else
-        {
-          s1DiffBelowThresholdCount = 0;
-        }
-        if (s1DiffBelowThresholdCount >= SAMPLE_SIZE && ssDiff < -400)
-        {
-          if (millis() - timeWithReadingBelow500 > 14400000)
-          {
-            Serial.println("Calibrating ..");
-            myMHZ19.calibrate();
-          }
-        }
-        if (CO2_LIGHT_DEBUG)
-        {
-          Serial.print("s1Diff: ");
-          Serial.println(s1Diff);
-        }
+        Serial.println("Calibrating ..");
+        co2Sensor->calibrate(400);
+        noteSensorCalibration(health, millis());
+        sampleWindow.s1DiffBelowThresholdCount = 0;
       }
-
-      sampleCounter++;
-      if (sampleCounter >= SAMPLE_SIZE)
+      float ssDiff = sampleWindow.ssDiff;
+      float s1Diff = sampleWindow.s1Diff;
+      if (CO2_LIGHT_DEBUG)
       {
-        sampleCounter = 0;
+        Serial.print("ssDiff: ");
+        Serial.println(ssDiff);
+        Serial.print("s1Diff: ");
+        Serial.println(s1Diff);
       }
 
-      if (isWiFiOK && shouldWriteToInflux)
+      // queued for the publishers, they send it once they are connected
+      if (publishQueue.publisherCount > 0)
       {
         sensor.clearFields();
         sensor.clearTags();
 
         sensor.addTag("device", deviceName + chipId);
         sensor.addTag("SSID", WiFi.SSID());
+        sensor.addTag("co2Sensor", co2Sensor->name());
 
         sensor.addField("rssi", WiFi.RSSI());
+        sensor.addField("wifiChannel", WiFi.channel());
+        sensor.addField("wifiConnectMs", wifiStats.lastConnectMs);
+        sensor.addField("wifiOutages", wifiStats.outages);
+        sensor.addField("wifiLastOutageMs", wifiStats.lastOutageMs);
+        sensor.addField("wifiOutageTotalMs", wifiStats.totalOutageMs);
+        sensor.addField("wifiRoams", wifiStats.roams);
+        sensor.addField("wifiFailedAttempts", wifiStats.failedAttempts);
         sensor.addField("ppm", CO2);
-        sensor.addField("mhzTemp", mhzTemp);
+        if (!isnan(mhzTemp))
+        {
+          sensor.addField("mhzTemp", mhzTemp);
+        }
+        if (!isnan(co2Reading.humidity))
+        {
+          sensor.addField("sensorHumidity", co2Reading.humidity);
+        }
         sensor.addField("readCountSinceLastBoot", readCount);
         sensor.addField("ssDiff", ssDiff);
         sensor.addField("s1Diff", s1Diff);
         sensor.addField("timeAbove500", millis() - timeWithReadingBelow500);
+        sensor.addField("interval", sampler.interval);
+        sensor.addField("brightness", globalBrightness);
+        sensor.addField("ledCurrent", averageLedCurrent(micros()));
+        sensor.addField("ventilating", room.ventilating);
+        sensor.addField("ventilationCount", room.ventilationCount);
+        sensor.addField("occupancy", room.occupancy);
+        sensor.addField("outdoorPPM", room.outdoor);
+        if (room.lastVentilationEnd != 0)
+        {
+          sensor.addField("minutesSinceVentilation", (millis() - room.lastVentilationEnd) / 60000);
+        }
+        if (!isnan(room.airExchangeRate))
+        {
+          sensor.addField("airExchangeRate", room.airExchangeRate);
+        }
+        if (!isnan(forecast.predicted))
+        {
+          sensor.addField("forecastPPM", forecast.predicted);
+        }
+        sensor.addField("ventilateSoon", forecast.warn);
+        sensor.addField("uptime", millis() / 1000);
+        sensor.addField("ledDuty", ledDuty);
+        sensor.addField("radioDuty", radioDuty);
         if (bmeOK)
         {
           float pressure = bme.readPressure();
           sensor.addField("seaLevelPressure", bme.seaLevelForAltitude(ALTITUDE, pressure));
           sensor.addField("temp", temp);
           sensor.addField("tempCompensation", tempCompensation);
+          sensor.addField("tempSelfHeating", selfHeating);
           sensor.addField("humidity", bme.readHumidity());
           sensor.addField("pressure", pressure);
         }
-        client.writePoint(sensor);
-        lastSuccessfulWriteTimer = millis();
+        if (time(nullptr) > 1600000000)
+        {
+          // points may be sent minutes later, without a synced clock the receiver stamps them
+          sensor.setTime((unsigned long long)time(nullptr));
+        }
+        enqueuePoint(sensor.toLineProtocol().c_str());
       }
 
       lastCO2 = CO2;
+      nextSampleInterval(sampler, CO2, millis());
+      if (bmeOK)
+      {
+        // without the model's own correction, otherwise it would feed back on itself
+        lastStaticTemp = temp - tempCompensation + atof(tempOffsetBME);
+      }
     }
   }
 }
 
+void updateBrightness()
+{
+  struct tm now;
+  int hour = getLocalTime(&now, 0) ? now.tm_hour : -1; // -1 until NTP has answered
+  uint8_t brightness = scheduledBrightness(hour);
+  if (ldrPin >= 0)
+  {
+    brightness = min(brightness, ambientBrightness(analogRead(ldrPin)));
+  }
+  if (brightness != globalBrightness)
+  {
+    setGlobalBrightness(brightness);
+    showScene();
+  }
+}
+
+#define LED_PIN_CASE(pin)                                                             \
+  case pin:                                                                           \
+    FastLED.addLeds<CHIPSET, pin, COLOR_ORDER>(ledOutput + strip.offset, strip.count); \
+    break;
+
+// FastLED needs the data pin at compile time, one case per entry of LED_PINS
+void addLedController(const LedStrip &strip)
+{
+  switch (strip.pin)
+  {
+    LED_PIN_CASE(2)
+    LED_PIN_CASE(4)
+    LED_PIN_CASE(5)
+    LED_PIN_CASE(13)
+    LED_PIN_CASE(14)
+    LED_PIN_CASE(15)
+    LED_PIN_CASE(18)
+    LED_PIN_CASE(19)
+    LED_PIN_CASE(23)
+    LED_PIN_CASE(25)
+    LED_PIN_CASE(26)
+    LED_PIN_CASE(27)
+    LED_PIN_CASE(32)
+    LED_PIN_CASE(33)
+  }
+}
+
 void initFastLED()
 {
+  if (ledLayout.stripCount == 0)
+  {
+    defaultLedLayout(ledLayout);
+  }
   defineColors();
-  FastLED.addLeds<CHIPSET, LED_PIN, COLOR_ORDER>(leds, NUM_LEDS);
+  initAnimations();
+  initBrightness();
+  for (int i = 0; i < ledLayout.stripCount; i++)
+  {
+    addLedController(ledLayout.strips[i]);
+  }
+  ledControllersStarted = true;
   FastLED.clear();
   if (CO2_LIGHT_DEBUG)
   {
@@ -390,7 +712,7 @@ void initFastLED()
   }
   setPixel(2, green[0]);
   setPixel(4, green[0]);
-  FastLED.show();
+  pushFrame();
 }
 
 void loadParamsFromSpiffs()
@@ -400,10 +722,12 @@ void loadParamsFromSpiffs()
 
   if (SPIFFS.begin(FORMAT_SPIFFS_ON_FAIL))
   {
-    if (SPIFFS.exists("/config.json"))
+    // storeParamsInJSON() may have been interrupted between removing the old and renaming the new file
+    const char *configPath = SPIFFS.exists("/config.json") ? "/config.json" : "/config.tmp";
+    if (SPIFFS.exists(configPath))
     {
       // file exists, reading and loading
-      File configFile = SPIFFS.open("/config.json", "r");
+      File configFile = SPIFFS.open(configPath, "r");
       if (configFile)
       {
         size_t size = configFile.size();
@@ -411,41 +735,10 @@ void loadParamsFromSpiffs()
         std::unique_ptr<char[]> buf(new char[size]);
 
         configFile.readBytes(buf.get(), size);
-        DynamicJsonDocument jsonDoc(1024);
-        deserializeJson(jsonDoc, buf.get());
+        DynamicJsonDocument jsonDoc(CONFIG_DOC_SIZE);
+        deserializeJson(jsonDoc, buf.get(), size); // the buffer has no terminating 0
 
-        if (jsonDoc.containsKey("influxDBURL"))
-        {
-          strcpy(influxDBURL, jsonDoc["influxDBURL"]);
-        }
-        if (jsonDoc.containsKey("influxDBOrg"))
-        {
-          strcpy(influxDBOrg, jsonDoc["influxDBOrg"]);
-        }
-        if (jsonDoc.containsKey("influxDBBucket"))
-        {
-          strcpy(influxDBBucket, jsonDoc["influxDBBucket"]);
-        }
-        if (jsonDoc.containsKey("influxDBToken"))
-        {
-          strcpy(influxDBToken, jsonDoc["influxDBToken"]);
-        }
-        if (jsonDoc.containsKey("lastestVersionURL"))
-        {
-          strcpy(lastestVersionURL, jsonDoc["lastestVersionURL"]);
-        }
-        if (jsonDoc.containsKey("firmwarePath"))
-        {
-          strcpy(firmwarePath, jsonDoc["firmwarePath"]);
-        }
-        if (jsonDoc.containsKey("useWifi"))
-        {
-          strcpy(useWifi, jsonDoc["useWifi"]);
-        }
-        if (jsonDoc.containsKey("tempOffsetBME"))
-        {
-          strcpy(tempOffsetBME, jsonDoc["tempOffsetBME"]);
-        }
+        applyParams(jsonDoc.as<JsonObject>(), false);
       }
       else
       {
@@ -465,7 +758,7 @@ void loadParamsFromSpiffs()
 
 void storeParamsInJSON()
 {
-  DynamicJsonDocument jsonDoc(1024);
+  DynamicJsonDocument jsonDoc(CONFIG_DOC_SIZE);
 
   jsonDoc["influxDBURL"] = influxDBURL;
   jsonDoc["influxDBOrg"] = influxDBOrg;
@@ -475,16 +768,61 @@ void storeParamsInJSON()
   jsonDoc["firmwarePath"] = firmwarePath;
   jsonDoc["useWifi"] = useWifi;
   jsonDoc["tempOffsetBME"] = tempOffsetBME;
+  jsonDoc["provisioningSeq"] = provisioningSeq;
+  jsonDoc["remoteConfigURL"] = remoteConfigURL;
+  jsonDoc["remoteConfigVersion"] = remoteConfigVersion;
+  jsonDoc["remoteConfigETag"] = remoteConfigETag;
+  jsonDoc["measurementInterval"] = measurementInterval;
+  jsonDoc["maxMeasurementInterval"] = maxMeasurementInterval;
+  jsonDoc["roomVolume"] = roomVolume;
+  jsonDoc["nightStart"] = brightnessSchedule.nightStart;
+  jsonDoc["nightEnd"] = brightnessSchedule.nightEnd;
+  jsonDoc["nightBrightness"] = brightnessSchedule.nightBrightness;
+  jsonDoc["ldrPin"] = ldrPin;
+  jsonDoc["timeZone"] = timeZone;
+  jsonDoc["mqttHost"] = mqttHost;
+  jsonDoc["mqttPort"] = mqttPort;
+  jsonDoc["mqttUser"] = mqttUser;
+  jsonDoc["mqttPass"] = mqttPass;
+  jsonDoc["mqttTopic"] = mqttTopic;
+  jsonDoc["mqttDiscovery"] = mqttDiscovery;
+  if (ledLayout.stripCount > 0)
+  {
+    storeLedLayout(jsonDoc.createNestedObject("ledLayout"));
+  }
+
+  JsonObject model = jsonDoc.createNestedObject("tempModel");
+  model["warm"] = tempModel.warm;
+  model["tau"] = tempModel.tau;
+  model["led"] = tempModel.led;
+  model["radio"] = tempModel.radio;
+  model["mhz"] = tempModel.mhz;
 
-  File configFile = SPIFFS.open("/config.json", "w");
+  // A truncated document would silently lose settings, keep the old file instead
+  if (jsonDoc.overflowed())
+  {
+    Serial.println("config too large, not saved");
+    return;
+  }
+
+  // Write to a temporary file first so a power loss never leaves a half written config
+  File configFile = SPIFFS.open("/config.tmp", "w");
   if (!configFile)
   {
     Serial.println("failed to open config file for writing");
+    return;
   }
 
-  serializeJson(jsonDoc, configFile);
-
+  size_t written = serializeJson(jsonDoc, configFile);
   configFile.close();
+  if (written == 0)
+  {
+    Serial.println("failed to write config file");
+    return;
+  }
+
+  SPIFFS.remove("/config.json");
+  SPIFFS.rename("/config.tmp", "/config.json");
 }
 
 void saveParams()
@@ -502,11 +840,20 @@ void saveParams()
     }
     strcpy(lastestVersionURL, lastestVersionURLParam.getValue());
     strcpy(firmwarePath, firmwarePathParam.getValue());
+    strlcpy(remoteConfigURL, remoteConfigURLParam.getValue(), sizeof(remoteConfigURL));
 
     strcpy(useWifi, useWifiParam.getValue());
 
     strcpy(tempOffsetBME, tempOffsetBMEParam.getValue());
 
+    strlcpy(mqttHost, mqttHostParam.getValue(), sizeof(mqttHost));
+    strlcpy(mqttPort, mqttPortParam.getValue(), sizeof(mqttPort));
+    strlcpy(mqttUser, mqttUserParam.getValue(), sizeof(mqttUser));
+    if (strcmp(mqttPassParam.getValue(), "") != 0)
+    {
+      strlcpy(mqttPass, mqttPassParam.getValue(), sizeof(mqttPass));
+    }
+
     storeParamsInJSON();
 
     if (CO2_LIGHT_DEBUG)
@@ -528,11 +875,156 @@ void saveParams()
 
     client.setConnectionParams(influxDBURL, influxDBOrg, influxDBBucket, influxDBToken);
     shouldWriteToInflux = client.validateConnection();
+    configureMqtt();
 
-    if (strcmp(calibrateNowParam.getValue(), "1") == 0)
+    if (strcmp(calibrateNowParam.getValue(), "1") == 0 && co2Sensor != nullptr)
     {
       Serial.println("Calibrating...");
-      myMHZ19.calibrate();
+      co2Sensor->calibrate(400);
+      noteSensorCalibration(health, millis());
+    }
+  }
+}
+
+// Document served at remoteConfigURL:
+//   {"version": 3, "config": {<keys of /config.json>}, "commands": [{"cmd": "calibrate", "ppm": 400}, {"cmd": "reboot"}]}
+// It is only applied if version is newer than the last applied one, commands run once per version.
+bool applyRemoteConfig(JsonObject doc)
+{
+  long version = doc["version"] | 0L;
+  if (version <= remoteConfigVersion)
+  {
+    return false;
+  }
+  // Validate everything before touching the config so a broken document changes nothing
+  JsonObject config = doc["config"];
+  JsonArray commands = doc["commands"];
+  if ((!doc["config"].isNull() && config.isNull()) || (!doc["commands"].isNull() && commands.isNull()))
+  {
+    Serial.println("Remote config malformed");
+    return false;
+  }
+
+  Serial.print("Applying remote config version ");
+  Serial.println(version);
+  if (!config.isNull())
+  {
+    applyParams(config, true);
+  }
+  remoteConfigVersion = version;
+  storeParamsInJSON();
+  updateSamplerBounds();
+
+  if (config.containsKey("influxDBURL") || config.containsKey("influxDBOrg") || config.containsKey("influxDBBucket") || config.containsKey("influxDBToken"))
+  {
+    client.setConnectionParams(influxDBURL, influxDBOrg, influxDBBucket, influxDBToken);
+    shouldWriteToInflux = client.validateConnection();
+  }
+  if (config.containsKey("mqttHost") || config.containsKey("mqttPort") || config.containsKey("mqttUser") || config.containsKey("mqttPass") ||
+      config.containsKey("mqttTopic") || config.containsKey("mqttDiscovery"))
+  {
+    configureMqtt();
+  }
+  if (config.containsKey("tempOffsetBME") && bmeOK)
+  {
+    bme.setTemperatureCompensation(atof(tempOffsetBME));
+  }
+
+  for (JsonObject command : commands)
+  {
+    const char *cmd = command["cmd"] | "";
+    if (strcmp(cmd, "calibrate") == 0 && co2Sensor != nullptr)
+    {
+      Serial.println("Calibrating ..");
+      co2Sensor->calibrate(command["ppm"] | 400);
+      noteSensorCalibration(health, millis());
+    }
+    else if (strcmp(cmd, "reboot") == 0)
+    {
+      shouldRestart = true;
+    }
+    else
+    {
+      Serial.print("Unknown remote command: ");
+      Serial.println(cmd);
+    }
+  }
+  return true;
+}
+
+void checkRemoteConfig()
+{
+  if (WiFi.isConnected() && strcmp(remoteConfigURL, "") != 0)
+  {
+    String url = remoteConfigURL;
+    url.replace("{chipId}", chipId);
+
+    WiFiClientSecure *client = new WiFiClientSecure;
+    if (client)
+    {
+      client->setInsecure();
+      {
+        // Add a scoping block for HTTPClient https to make sure it is destroyed before WiFiClientSecure *client is
+        HTTPClient https;
+        https.setUserAgent(deviceName + chipId + " " + VERSION);
+        const char *headerKeys[] = {"ETag"};
+        https.collectHeaders(headerKeys, 1);
+
+        if (https.begin(*client, url))
+        {
+          // Conditional GET, an unchanged document costs only the 304 response
+          if (remoteConfigETag != "")
+          {
+            https.addHeader("If-None-Match", remoteConfigETag);
+          }
+          int httpCode = https.GET();
+          if (httpCode == HTTP_CODE_NOT_MODIFIED)
+          {
+            Serial.println("Remote config unchanged");
+          }
+          else if (httpCode == HTTP_CODE_OK)
+          {
+            DynamicJsonDocument doc(2048);
+            DeserializationError error = deserializeJson(doc, https.getStream());
+            if (error)
+            {
+              Serial.print("Remote config invalid: ");
+              Serial.println(error.c_str());
+            }
+            else
+            {
+              String etag = https.header("ETag");
+              bool etagChanged = etag != remoteConfigETag;
+              remoteConfigETag = etag;
+              if (!applyRemoteConfig(doc.as<JsonObject>()) && etagChanged)
+              {
+                storeParamsInJSON(); // remember the ETag of a document we already have
+              }
+            }
+          }
+          else if (httpCode > 0)
+          {
+            Serial.printf("[HTTPS] GET... code: %d\n", httpCode);
+          }
+          else
+          {
+            Serial.printf("[HTTPS] GET... failed, error: %s\n", https.errorToString(httpCode).c_str());
+          }
+
+          https.end();
+        }
+        else
+        {
+          Serial.printf("[HTTPS] Unable to connect\n");
+        }
+
+        // End extra scoping block
+      }
+      delete client;
+    }
+    else
+    {
+      Serial.println("Unable to create client");
     }
   }
 }
@@ -562,6 +1054,35 @@ void initIfAllBuildFlagsAreSet()
 #endif
 }
 
+bool joinProvisioningNetwork()
+{
+  // Unconfigured devices join a staging network and wait for a bundle from tools/provision.py
+#if defined(PROVISIONING_KEY) && defined(PROVISIONING_SSID) && defined(PROVISIONING_PASS)
+  WiFi.mode(WIFI_STA);
+  if (WiFi.psk() == "" && strcmp(influxDBBucket, "") == 0)
+  {
+    // Don't store the staging network, the bundle brings the real one
+    WiFi.persistent(false);
+    WiFi.begin(PROVISIONING_SSID, PROVISIONING_PASS);
+    unsigned long start = millis();
+    while (!WiFi.isConnected() && millis() - start < 15000)
+    {
+      delay(100);
+    }
+    return WiFi.isConnected();
+  }
+#endif
+  return false;
+}
+
+bool applyProvisioningBundle(JsonObject config)
+{
+  applyParams(config, true);
+  storeParamsInJSON();
+  // restart to connect Wi-Fi and Influx with the new settings
+  return true;
+}
+
 void setupWifi()
 {
   initIfAllBuildFlagsAreSet();
@@ -574,8 +1095,14 @@ void setupWifi()
   influxDBTokenParam.setValue("", 128);
   lastestVersionURLParam.setValue(lastestVersionURL, 32);
   firmwarePathParam.setValue(firmwarePath, 32);
+  remoteConfigURLParam.setValue(remoteConfigURL, 100);
   useWifiParam.setValue(useWifi, 2);
   tempOffsetBMEParam.setValue(tempOffsetBME, 5);
+  mqttHostParam.setValue(mqttHost, 64);
+  mqttPortParam.setValue(mqttPort, 6);
+  mqttUserParam.setValue(mqttUser, 32);
+  // Don't set the password, otherwise it can be read from the web portal
+  mqttPassParam.setValue("", 64);
 
   wm.addParameter(&influxDBURLParam);
   wm.addParameter(&influxDBOrgParam);
@@ -583,8 +1110,13 @@ void setupWifi()
   wm.addParameter(&influxDBTokenParam);
   wm.addParameter(&lastestVersionURLParam);
   wm.addParameter(&firmwarePathParam);
+  wm.addParameter(&remoteConfigURLParam);
   wm.addParameter(&useWifiParam);
   wm.addParameter(&tempOffsetBMEParam);
+  wm.addParameter(&mqttHostParam);
+  wm.addParameter(&mqttPortParam);
+  wm.addParameter(&mqttUserParam);
+  wm.addParameter(&mqttPassParam);
   wm.addParameter(&calibrateNowParam);
 
   wm.setSaveParamsCallback(saveParams);
@@ -596,12 +1128,76 @@ void setupWifi()
 
   wm.setClass("invert");
   wm.setHostname((deviceName + chipId).c_str());
+  if (joinProvisioningNetwork())
+  {
+    isWiFiOK = true;
+  }
+  else if (strcmp(useWifi, "1") == 0)
+  {
+    isWiFiOK = wifiFastConnect((deviceName + chipId).c_str()) || wm.autoConnect((deviceName + chipId).c_str(), ("pass" + chipId).c_str());
+  }
   if (strcmp(useWifi, "1") == 0)
   {
-    isWiFiOK = wm.autoConnect((deviceName + chipId).c_str(), ("pass" + chipId).c_str());
+    // also retries with backoff if neither worked
+    beginWiFiConnection();
   }
 }
 
+// Local time for the brightness schedule. SNTP needs the network stack, so it
+// starts with the first connection, which may come long after boot.
+bool timeSyncStarted = false;
+
+void handleTimeSync()
+{
+  if (!timeSyncStarted && WiFi.status() == WL_CONNECTED)
+  {
+    configTzTime(timeZone, "pool.ntp.org", "time.nist.gov");
+    timeSyncStarted = true;
+  }
+}
+
+// The Influx server may have changed or come back while the device was offline,
+// so the connection is validated again every time Wi-Fi comes up.
+bool influxLinkUp = false;
+
+void connectInflux()
+{
+  if (CO2_LIGHT_DEBUG)
+  {
+    Serial.println("### INFLUX ###");
+    Serial.print("URL: ");
+    Serial.println(influxDBURL);
+    Serial.print("Org: ");
+    Serial.println(influxDBOrg);
+    Serial.print("Bucket: ");
+    Serial.println(influxDBBucket);
+    Serial.print("Token: ");
+    Serial.println(influxDBToken);
+    Serial.print("Latest URL: ");
+    Serial.println(lastestVersionURL);
+    Serial.print("Firmware Path: ");
+    Serial.println(firmwarePath);
+  }
+  setCrashPhase(PHASE_INFLUX);
+  client.setConnectionParams(influxDBURL, influxDBOrg, influxDBBucket, influxDBToken);
+  client.setInsecure();
+  // the points carry the time they were measured in seconds
+  client.setWriteOptions(WriteOptions().writePrecision(WritePrecision::S));
+  shouldWriteToInflux = client.validateConnection();
+}
+
+void handleInfluxReconnect()
+{
+  bool connected = WiFi.status() == WL_CONNECTED;
+  if (connected && !influxLinkUp && !safeMode)
+  {
+    connectInflux();
+  }
+  influxLinkUp = connected;
+}
+
+#define BOOT_STEPS 5 // config, Wi-Fi, Influx, CO2 sensor, BME280
+
 void toggleShouldStartPortal()
 {
   shouldShowPortal = !shouldShowPortal;
@@ -611,43 +1207,51 @@ void setup()
 {
   Serial.begin(115200);
   setChipId();
-  loadParamsFromSpiffs(); // read params from config.json
+  loadParamsFromSpiffs(); // read params from config.json, the LED layout is part of it
+  beginCrashGuard(VERSION);
+  loadSensorHealth();
+  initFastLED();
+  setBootProgress(1, BOOT_STEPS);
 
-  setupWifi();
+  if (!safeMode)
+  {
+    setCrashPhase(PHASE_WIFI);
+    setupWifi();
+  }
+  setBootProgress(2, BOOT_STEPS);
+#ifdef PROVISIONING_KEY
+  if (!safeMode)
+  {
+    setupProvisioning(PROVISIONING_KEY, chipId, deviceName + chipId, applyProvisioningBundle, strcmp(influxDBBucket, "") == 0);
+    setAnimation(ANIM_BREATHING, provisioningUnconfigured);
+  }
+#endif
 
   pinMode(START_SETUP_PIN, INPUT_PULLUP);
   attachInterrupt(START_SETUP_PIN, toggleShouldStartPortal, FALLING);
 
-  if (isWiFiOK)
+  handleTimeSync();
+  handleInfluxReconnect();
+  if (!safeMode)
   {
-    if (CO2_LIGHT_DEBUG)
-    {
-      Serial.println("### INFLUX ###");
-      Serial.print("URL: ");
-      Serial.println(influxDBURL);
-      Serial.print("Org: ");
-      Serial.println(influxDBOrg);
-      Serial.print("Bucket: ");
-      Serial.println(influxDBBucket);
-      Serial.print("Token: ");
-      Serial.println(influxDBToken);
-      Serial.print("Latest URL: ");
-      Serial.println(lastestVersionURL);
-      Serial.print("Firmware Path: ");
-      Serial.println(firmwarePath);
-    }
-    client.setConnectionParams(influxDBURL, influxDBOrg, influxDBBucket, influxDBToken);
-    client.setInsecure();
-    shouldWriteToInflux = client.validateConnection();
+    addPublisher(&influx);
+    configureMqtt();
+    addPublisher(&mqtt);
   }
+  setBootProgress(3, BOOT_STEPS);
 
+  setCrashPhase(PHASE_SENSOR);
   mySerial.begin(BAUDRATE, SERIAL_8N1, RX_PIN, TX_PIN);
-  myMHZ19.begin(mySerial);
-  MHZ19OK = myMHZ19.errorCode == RESULT_OK;
-  myMHZ19.setRange(5000);
-  myMHZ19.autoCalibration(false);
-
-  initFastLED();
+  Wire.begin();
+  co2Sensor = detectCO2Sensor(co2SensorCandidates, sizeof(co2SensorCandidates) / sizeof(co2SensorCandidates[0]));
+  co2SensorOK = co2Sensor != nullptr;
+  if (co2SensorOK)
+  {
+    // the MH-Z19 is calibrated in readCO2(), the others keep their own ABC
+    co2Sensor->setNativeABC(!co2Sensor->hasCapability(SENSOR_CAP_FIRMWARE_CALIBRATION));
+  }
+  updateSamplerBounds();
+  setBootProgress(4, BOOT_STEPS);
 
   if (!bme.begin(0x76, &Wire))
   {
@@ -667,22 +1271,37 @@ void setup()
     bme.setTemperatureCompensation(atof(tempOffsetBME));
   }
 
+  setBootProgress(BOOT_STEPS, BOOT_STEPS);
+
+  if (co2SensorOK)
+  {
+    hasNewReading = co2Sensor->poll(co2Reading);
+  }
   readCO2();
 
 }
 
 void loop()
 {
-  if (millis() - getDataTimer > MEASUREMENT_INTERVAL)
+  handleCrashGuard(VERSION);
+  if (millis() - getDataTimer > sampler.interval)
   {
+    setCrashPhase(PHASE_SENSOR);
+    // the sensor is only polled when a reading is due, the UART sensors stay quiet in between
     isWiFiOK = WiFi.status() == WL_CONNECTED;
-    readCO2();
-    getDataTimer = millis();
+    if (co2Sensor == nullptr || co2Sensor->poll(co2Reading))
+    {
+      hasNewReading = co2Sensor != nullptr;
+      readCO2();
+      getDataTimer = millis();
+    }
   }
+  setCrashPhase(PHASE_LOOP);
   if (millis() - getBlinkTimer > 500)
   {
-    MHZ19OK = myMHZ19.errorCode == RESULT_OK;
-    if (!MHZ19OK)
+    updateBrightness();
+    co2SensorOK = co2Sensor != nullptr && co2Sensor->ok();
+    if (!co2SensorOK)
     {
       if (leds[4] == green[0])
       {
@@ -704,11 +1323,12 @@ void loop()
         setPixel(2, green[0]);
       }
     }
-    FastLED.show();
+    showScene();
     getBlinkTimer = millis();
   }
-  if (shouldShowPortal && !portalRunning)
+  if (shouldShowPortal && !portalRunning && !safeMode)
   {
+    setCrashPhase(PHASE_PORTAL);
     if (WiFi.status() == WL_CONNECTED)
     {
       wm.startWebPortal();
@@ -726,20 +1346,49 @@ void loop()
   }
   if (portalRunning)
   {
+    setCrashPhase(PHASE_PORTAL);
     wm.process();
+    setCrashPhase(PHASE_LOOP);
+  }
+  else
+  {
+    setCrashPhase(PHASE_WIFI);
+    handleWiFiConnection();
+    setCrashPhase(PHASE_LOOP);
   }
+  handleTimeSync();
+  handleInfluxReconnect();
+  setCrashPhase(PHASE_LOOP);
+  if (co2Sensor != nullptr && sensorHealthDue(health, co2Sensor->transactions(), co2Sensor->failures(), millis()))
+  {
+    publishHealth();
+    storeSensorHealth();
+  }
+  setCrashPhase(PHASE_PUBLISH);
+  publishCrashReport();
+  flushPublishers();
+  setCrashPhase(PHASE_LOOP);
+  handleProvisioning();
+  tickAnimations();
   if (isWiFiOK && ((millis() > 45000 && checkCount == 0) || millis() - lastUpdateTimer > 3600000)) // 43200000))
   {
+    setCrashPhase(PHASE_UPDATE);
     checkUpdate();
+    checkRemoteConfig();
 
-    if (Version(VERSION) < Version(newVersion.c_str()))
+    // a version that was rolled back after crashing is not installed again
+    if (Version(VERSION) < Version(newVersion.c_str()) && !(Version(newVersion.c_str()) == Version(crashReport.blockedVersion.c_str())))
     {
       processOTAUpdate();
     }
     checkCount++;
     lastUpdateTimer = millis();
   }
-  if (!isWiFiOK && strcmp(useWifi, "1") == 0 && strcmp(influxDBBucket, "") != 0 && strcmp(influxDBOrg, "") != 0 && strcmp(influxDBBucket, "") != 0 && strcmp(influxDBToken, "") != 0)
+  if (shouldRestart)
+  {
+    ESP.restart();
+  }
+  if (!isWiFiOK && !safeMode && strcmp(useWifi, "1") == 0 && strcmp(influxDBBucket, "") != 0 && strcmp(influxDBOrg, "") != 0 && strcmp(influxDBBucket, "") != 0 && strcmp(influxDBToken, "") != 0)
   {
     if (millis() - lastSuccessfulWriteTimer > 3600000)
     {
@@ -0,0 +1,326 @@
+#include <Arduino.h>
+#include <Client.h>
+
+#ifndef MqttClient_H_
+#define MqttClient_H_
+
+/*
+Minimal MQTT 3.1.1 client on top of an Arduino Client (WiFiClient on the device).
+
+Supports what the publisher needs: CONNECT with last will and a persistent
+session, PUBLISH with QoS 0 or 1, PUBACK, keep alive. PubSubClient can only
+publish with QoS 0. The client stores no messages: PUBACKs are handed out with
+takeAck() and the caller resends what wasn't acknowledged after a reconnect.
+
+Incoming packets are parsed byte by byte without blocking, except the CONNACK
+that connect() waits for.
+*/
+
+#define MQTT_KEEPALIVE 30         // s
+#define MQTT_CONNECT_TIMEOUT 5000 // ms to wait for the CONNACK
+#define MQTT_MAX_PACKET 1536      // largest packet sent, a full Environment point is ~900 bytes
+#define MQTT_RX_BUFFER 16         // only small packets (CONNACK, PUBACK, PINGRESP) are read
+#define MQTT_MAX_ACKS 32
+#define MQTT_HEADER_SIZE 5 // type + up to 4 bytes remaining length
+
+class MqttClient
+{
+public:
+    explicit MqttClient(Client &net) : net(net) {}
+
+    bool connect(const char *host, uint16_t port, const char *clientId, const char *user, const char *pass,
+                 const char *willTopic, const char *willMessage)
+    {
+        net.stop();
+        rxState = 0;
+        ackHead = ackCount = 0;
+        pingOutstanding = false;
+        isConnected = false;
+        if (!net.connect(host, port))
+        {
+            return false;
+        }
+
+        static const uint8_t protocol[] = {0, 4, 'M', 'Q', 'T', 'T', 4};
+        size_t pos = MQTT_HEADER_SIZE;
+        memcpy(txBuffer + pos, protocol, sizeof(protocol));
+        pos += sizeof(protocol);
+        // clean session not set: the broker keeps the session over reconnects
+        uint8_t flags = 0;
+        if (willTopic != nullptr)
+        {
+            flags |= 0x04 | 0x08 | 0x20; // will, will QoS 1, will retain
+        }
+        if (user != nullptr && user[0] != 0)
+        {
+            flags |= 0x80;
+            if (pass != nullptr)
+            {
+                flags |= 0x40;
+            }
+        }
+        txBuffer[pos++] = flags;
+        txBuffer[pos++] = MQTT_KEEPALIVE >> 8;
+        txBuffer[pos++] = MQTT_KEEPALIVE & 0xFF;
+        bool fits = putString(pos, clientId, strlen(clientId));
+        if (willTopic != nullptr)
+        {
+            fits = fits && putString(pos, willTopic, strlen(willTopic)) && putString(pos, willMessage, strlen(willMessage));
+        }
+        if (flags & 0x80)
+        {
+            fits = fits && putString(pos, user, strlen(user));
+        }
+        if (flags & 0x40)
+        {
+            fits = fits && putString(pos, pass, strlen(pass));
+        }
+        if (!fits || !sendPacket(0x10, pos - MQTT_HEADER_SIZE))
+        {
+            net.stop();
+            return false;
+        }
+
+        connackCode = -1;
+        unsigned long start = millis();
+        while (connackCode < 0 && net.connected() && millis() - start < MQTT_CONNECT_TIMEOUT)
+        {
+            readIncoming();
+            if (connackCode < 0)
+            {
+                delay(1);
+            }
+        }
+        isConnected = connackCode == 0;
+        if (!isConnected)
+        {
+            net.stop();
+        }
+        return isConnected;
+    }
+
+    uint16_t nextPacketId()
+    {
+        packetId = packetId == 0xFFFF ? 1 : packetId + 1;
+        return packetId;
+    }
+
+    // packetId is only used with qos 1, dup marks a resend
+    bool publish(const char *topic, const char *payload, size_t length, bool retained, uint8_t qos, uint16_t id, bool dup)
+    {
+        if (!isConnected)
+        {
+            return false;
+        }
+        size_t pos = MQTT_HEADER_SIZE;
+        if (!putString(pos, topic, strlen(topic)))
+        {
+            return false;
+        }
+        if (qos > 0)
+        {
+            txBuffer[pos++] = id >> 8;
+            txBuffer[pos++] = id & 0xFF;
+        }
+        if (pos + length > sizeof(txBuffer))
+        {
+            return false;
+        }
+        memcpy(txBuffer + pos, payload, length);
+        pos += length;
+        return sendPacket(0x30 | (dup ? 0x08 : 0) | (qos << 1) | (retained ? 0x01 : 0), pos - MQTT_HEADER_SIZE);
+    }
+
+    // Reads incoming packets and keeps the connection alive, false once it is gone
+    bool loop()
+    {
+        if (!isConnected)
+        {
+            return false;
+        }
+        if (!net.connected())
+        {
+            isConnected = false;
+            return false;
+        }
+        readIncoming();
+        unsigned long now = millis();
+        if (pingOutstanding && now - pingSent > MQTT_KEEPALIVE * 1000UL)
+        {
+            // no answer within a keep alive period, the connection is dead even if TCP doesn't know yet
+            disconnect();
+            return false;
+        }
+        if (!pingOutstanding && now - lastSend > MQTT_KEEPALIVE * 750UL)
+        {
+            pingOutstanding = sendPacket(0xC0, 0);
+            pingSent = now;
+        }
+        return isConnected;
+    }
+
+    bool connected()
+    {
+        return isConnected && net.connected();
+    }
+
+    void disconnect()
+    {
+        if (isConnected)
+        {
+            sendPacket(0xE0, 0);
+        }
+        isConnected = false;
+        net.stop();
+    }
+
+    // Oldest PUBACK not taken yet, 0 if there is none
+    uint16_t takeAck()
+    {
+        if (ackCount == 0)
+        {
+            return 0;
+        }
+        uint16_t id = acks[ackHead];
+        ackHead = (ackHead + 1) % MQTT_MAX_ACKS;
+        ackCount--;
+        return id;
+    }
+
+private:
+    Client &net;
+    uint8_t txBuffer[MQTT_MAX_PACKET];
+    uint8_t rxBuffer[MQTT_RX_BUFFER];
+    uint8_t rxType = 0;
+    uint32_t rxLength = 0;
+    uint32_t rxPos = 0;
+    uint8_t rxShift = 0;
+    uint8_t rxState = 0; // 0: type, 1: remaining length, 2: body
+    uint16_t acks[MQTT_MAX_ACKS];
+    int ackHead = 0;
+    int ackCount = 0;
+    uint16_t packetId = 0;
+    int connackCode = -1;
+    bool isConnected = false;
+    bool pingOutstanding = false;
+    unsigned long pingSent = 0;
+    unsigned long lastSend = 0;
+
+    bool putString(size_t &pos, const char *s, size_t length)
+    {
+        if (pos + 2 + length > sizeof(txBuffer))
+        {
+            return false;
+        }
+        txBuffer[pos++] = length >> 8;
+        txBuffer[pos++] = length & 0xFF;
+        memcpy(txBuffer + pos, s, length);
+        pos += length;
+        return true;
+    }
+
+    // The body is at txBuffer + MQTT_HEADER_SIZE, the fixed header goes right before it
+    bool sendPacket(uint8_t type, size_t bodyLength)
+    {
+        uint8_t header[MQTT_HEADER_SIZE];
+        size_t headerLength = 0;
+        header[headerLength++] = type;
+        size_t remaining = bodyLength;
+        do
+        {
+            uint8_t digit = remaining & 0x7F;
+            remaining >>= 7;
+            header[headerLength++] = remaining > 0 ? digit | 0x80 : digit;
+        } while (remaining > 0);
+        uint8_t *start = txBuffer + MQTT_HEADER_SIZE - headerLength;
+        memcpy(start, header, headerLength);
+        size_t length = headerLength + bodyLength;
+        // one write per packet, the TCP stack sends it as one segment
+        if (net.write(start, length) != length)
+        {
+            isConnected = false;
+            net.stop();
+            return false;
+        }
+        lastSend = millis();
+        return true;
+    }
+
+    void readIncoming()
+    {
+        uint8_t chunk[64];
+        int available;
+        while ((available = net.available()) > 0)
+        {
+            int count = net.read(chunk, available < (int)sizeof(chunk) ? available : sizeof(chunk));
+            if (count <= 0)
+            {
+                return;
+            }
+            for (int i = 0; i < count; i++)
+            {
+                feed(chunk[i]);
+            }
+        }
+    }
+
+    void feed(uint8_t b)
+    {
+        switch (rxState)
+        {
+        case 0:
+            rxType = b;
+            rxLength = 0;
+            rxShift = 0;
+            rxState = 1;
+            break;
+        case 1:
+            rxLength |= (uint32_t)(b & 0x7F) << rxShift;
+            rxShift += 7;
+            if (!(b & 0x80))
+            {
+                rxPos = 0;
+                rxState = 2;
+                if (rxLength == 0)
+                {
+                    handlePacket();
+                }
+            }
+            break;
+        default:
+            // larger packets (PUBLISH from an old subscription) are skipped
+            if (rxPos < sizeof(rxBuffer))
+            {
+                rxBuffer[rxPos] = b;
+            }
+            if (++rxPos == rxLength)
+            {
+                handlePacket();
+            }
+            break;
+        }
+    }
+
+    void handlePacket()
+    {
+        switch (rxType >> 4)
+        {
+        case 2: // CONNACK
+            connackCode = rxLength >= 2 ? rxBuffer[1] : 255;
+            break;
+        case 4: // PUBACK
+            if (rxLength >= 2 && ackCount < MQTT_MAX_ACKS)
+            {
+                acks[(ackHead + ackCount) % MQTT_MAX_ACKS] = (rxBuffer[0] << 8) | rxBuffer[1];
+                ackCount++;
+            }
+            break;
+        case 13: // PINGRESP
+            pingOutstanding = false;
+            break;
+        }
+        rxState = 0;
+    }
+};
+
+#endif
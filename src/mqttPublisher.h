@@ -0,0 +1,366 @@
+#include <Arduino.h>
+#include <Client.h>
+#include <stdio.h>
+#include <string>
+#include "mqttClient.h"
+#include "publisher.h"
+
+#ifndef MqttPublisher_H_
+#define MqttPublisher_H_
+
+/*
+MQTT backend of the publisher queue, for sites with a local broker (Home
+Assistant, Node-RED) instead of a reachable Influx.
+
+Every point goes to <base>/<measurement> as a JSON object of its tags, fields and
+timestamp, retained so a subscriber always gets the current values, with QoS 1.
+Up to MQTT_MAX_INFLIGHT messages wait for their PUBACK at the same time; the
+queue only moves on once they are acknowledged and resends the rest after a
+reconnect. <base>/status is "online" while connected and the last will sets it
+to "offline".
+
+With a discovery prefix (Home Assistant uses "homeassistant") the sensors are
+announced once per connection so they show up without any configuration.
+*/
+
+#define MQTT_MAX_INFLIGHT 8
+#define MQTT_RETRY_MIN 2000  // ms after the first failed connect, doubles up to MQTT_RETRY_MAX
+#define MQTT_RETRY_MAX 60000 // ms
+#define MQTT_STATE_MEASUREMENT "Environment" // the point main.cpp writes per reading
+
+struct DiscoverySensor
+{
+    const char *field;
+    const char *name;
+    const char *unit;
+    const char *deviceClass;
+    const char *scale; // appended to the value template
+};
+
+const DiscoverySensor DISCOVERY_SENSORS[] = {
+    {"ppm", "CO2", "ppm", "carbon_dioxide", ""},
+    {"forecastPPM", "CO2 in 15 min", "ppm", "carbon_dioxide", ""},
+    {"temp", "Temperature", "°C", "temperature", ""},
+    {"humidity", "Humidity", "%", "humidity", ""},
+    {"pressure", "Pressure", "hPa", "pressure", " / 100"},
+    {"occupancy", "Occupancy", "", "", ""},
+    {"rssi", "Wi-Fi signal", "dBm", "signal_strength", ""},
+};
+
+void appendJsonString(std::string &json, const std::string &s)
+{
+    json += '"';
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+        {
+            json += '\\';
+            json += c;
+        }
+        else if ((unsigned char)c < 0x20)
+        {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            json += escaped;
+        }
+        else
+        {
+            json += c;
+        }
+    }
+    json += '"';
+}
+
+// Reads up to an unescaped stop character, line protocol escapes with a backslash
+std::string readLineToken(const std::string &line, size_t &pos, const char *stops)
+{
+    std::string token;
+    while (pos < line.size() && strchr(stops, line[pos]) == nullptr)
+    {
+        if (line[pos] == '\\' && pos + 1 < line.size())
+        {
+            pos++;
+        }
+        token += line[pos++];
+    }
+    return token;
+}
+
+// measurement,tag=a,tag=b field=1i,field=2.5,field="s",field=true 1700000000
+// becomes {"tag":"a","tag":"b","field":1,"field":2.5,"field":"s","field":true,"time":1700000000}
+bool lineToJson(const std::string &line, std::string &measurement, std::string &json)
+{
+    size_t pos = 0;
+    measurement = readLineToken(line, pos, ", ");
+    json = "{";
+    bool first = true;
+    while (pos < line.size() && line[pos] == ',')
+    {
+        pos++;
+        std::string key = readLineToken(line, pos, "=");
+        pos++;
+        std::string value = readLineToken(line, pos, ", ");
+        json += first ? "" : ",";
+        appendJsonString(json, key);
+        json += ':';
+        appendJsonString(json, value);
+        first = false;
+    }
+    if (pos >= line.size() || line[pos] != ' ')
+    {
+        return false;
+    }
+    do
+    {
+        pos++;
+        std::string key = readLineToken(line, pos, "=");
+        if (pos >= line.size())
+        {
+            return false;
+        }
+        pos++;
+        json += first ? "" : ",";
+        appendJsonString(json, key);
+        json += ':';
+        first = false;
+        if (pos < line.size() && line[pos] == '"')
+        {
+            pos++;
+            appendJsonString(json, readLineToken(line, pos, "\""));
+            pos++;
+            continue;
+        }
+        std::string value = readLineToken(line, pos, ", ");
+        if (value.empty())
+        {
+            return false;
+        }
+        if (value == "t" || value == "T" || value == "true" || value == "True" || value == "TRUE")
+        {
+            json += "true";
+        }
+        else if (value == "f" || value == "F" || value == "false" || value == "False" || value == "FALSE")
+        {
+            json += "false";
+        }
+        else
+        {
+            if (value.back() == 'i' || value.back() == 'u')
+            {
+                value.pop_back();
+            }
+            json += value;
+        }
+    } while (pos < line.size() && line[pos] == ',');
+    if (pos < line.size() && line[pos] == ' ')
+    {
+        pos++;
+        json += ",\"time\":";
+        json += readLineToken(line, pos, " ");
+    }
+    json += '}';
+    return true;
+}
+
+class MqttPublisher : public Publisher
+{
+public:
+    unsigned long connects = 0;
+    unsigned long failedConnects = 0;
+    unsigned long published = 0;
+    unsigned long resent = 0;
+    unsigned long lastConnectMs = 0; // TCP + CONNECT/CONNACK of the last connect
+    uint32_t inflightLimit = MQTT_MAX_INFLIGHT;
+
+    explicit MqttPublisher(Client &net) : mqtt(net) {}
+
+    // host empty disables the backend, discoveryPrefix empty disables Home Assistant discovery
+    void configure(const char *host, uint16_t port, const char *user, const char *pass, const std::string &baseTopic,
+                   const char *discoveryPrefix, const std::string &clientId, const std::string &deviceName, const char *version)
+    {
+        // new settings take effect with the next connect
+        mqtt.disconnect();
+        this->host = host;
+        this->port = port;
+        this->user = user;
+        this->pass = pass;
+        this->baseTopic = baseTopic;
+        this->discoveryPrefix = discoveryPrefix;
+        this->clientId = clientId;
+        this->deviceName = deviceName;
+        this->version = version;
+        statusTopic = baseTopic + "/status";
+    }
+
+    const char *name() const override { return "mqtt"; }
+
+    uint32_t window() const override { return inflightLimit < MQTT_MAX_INFLIGHT ? inflightLimit : MQTT_MAX_INFLIGHT; }
+
+    bool ready() override
+    {
+        if (host.empty())
+        {
+            return false;
+        }
+        if (mqtt.connected())
+        {
+            return true;
+        }
+        unsigned long now = millis();
+        if (retryDelay != 0 && now - lastAttempt < retryDelay)
+        {
+            return false;
+        }
+        lastAttempt = now;
+        if (!mqtt.connect(host.c_str(), port, clientId.c_str(), user.c_str(), pass.c_str(), statusTopic.c_str(), "offline"))
+        {
+            failedConnects++;
+            retryDelay = retryDelay == 0 ? MQTT_RETRY_MIN : retryDelay * 2 > MQTT_RETRY_MAX ? MQTT_RETRY_MAX : retryDelay * 2;
+            return false;
+        }
+        // the first attempt after losing a connection is immediate, only failures back off
+        retryDelay = 0;
+        lastConnectMs = millis() - now;
+        connects++;
+        inflightCount = 0;
+        next = acked; // unacknowledged points are sent again
+        mqtt.publish(statusTopic.c_str(), "online", 6, true, 1, mqtt.nextPacketId(), false);
+        if (!discoveryPrefix.empty())
+        {
+            sendDiscovery();
+        }
+        return true;
+    }
+
+    bool send(const std::string &line, uint32_t seq) override
+    {
+        Inflight &entry = inflight[(inflightHead + inflightCount) % MQTT_MAX_INFLIGHT];
+        entry.seq = seq;
+        entry.done = false;
+        std::string measurement;
+        if (!lineToJson(line, measurement, payload))
+        {
+            // can't be published, don't let it block the queue
+            entry.packetId = 0;
+            entry.done = true;
+            inflightCount++;
+            return true;
+        }
+        topic = baseTopic + "/" + measurement;
+        entry.packetId = mqtt.nextPacketId();
+        bool dup = seq < sentEnd;
+        if (!mqtt.publish(topic.c_str(), payload.c_str(), payload.size(), true, 1, entry.packetId, dup))
+        {
+            return false;
+        }
+        inflightCount++;
+        published++;
+        resent += dup ? 1 : 0;
+        sentEnd = seq + 1 > sentEnd ? seq + 1 : sentEnd;
+        return true;
+    }
+
+    void poll() override
+    {
+        if (!mqtt.loop())
+        {
+            // connection lost, what is in flight goes out again after the reconnect
+            inflightCount = 0;
+            next = acked;
+            return;
+        }
+        uint16_t id;
+        while ((id = mqtt.takeAck()) != 0)
+        {
+            for (int i = 0; i < inflightCount; i++)
+            {
+                Inflight &entry = inflight[(inflightHead + i) % MQTT_MAX_INFLIGHT];
+                if (entry.packetId == id)
+                {
+                    entry.done = true;
+                }
+            }
+        }
+        // acked only moves over a gap-free run of confirmed points
+        while (inflightCount > 0 && inflight[inflightHead].done)
+        {
+            uint32_t seq = inflight[inflightHead].seq;
+            acked = seq + 1 > acked ? seq + 1 : acked;
+            inflightHead = (inflightHead + 1) % MQTT_MAX_INFLIGHT;
+            inflightCount--;
+        }
+    }
+
+    bool connected()
+    {
+        return mqtt.connected();
+    }
+
+private:
+    struct Inflight
+    {
+        uint16_t packetId;
+        uint32_t seq;
+        bool done;
+    };
+
+    MqttClient mqtt;
+    std::string host;
+    uint16_t port = 1883;
+    std::string user;
+    std::string pass;
+    std::string baseTopic;
+    std::string statusTopic;
+    std::string discoveryPrefix;
+    std::string clientId;
+    std::string deviceName;
+    std::string version;
+    std::string topic;   // reused to avoid allocations per message
+    std::string payload; // reused to avoid allocations per message
+    Inflight inflight[MQTT_MAX_INFLIGHT];
+    int inflightHead = 0;
+    int inflightCount = 0;
+    uint32_t sentEnd = 0; // points before this one were sent at least once
+    unsigned long lastAttempt = 0;
+    unsigned long retryDelay = 0;
+
+    void sendDiscovery()
+    {
+        std::string stateTopic = baseTopic + "/" + MQTT_STATE_MEASUREMENT;
+        for (const DiscoverySensor &sensor : DISCOVERY_SENSORS)
+        {
+            std::string id = clientId + "_" + sensor.field;
+            std::string config = "{\"name\":";
+            appendJsonString(config, sensor.name);
+            config += ",\"unique_id\":";
+            appendJsonString(config, id);
+            config += ",\"state_topic\":";
+            appendJsonString(config, stateTopic);
+            config += ",\"value_template\":";
+            appendJsonString(config, std::string("{{ value_json.") + sensor.field + sensor.scale + " }}");
+            if (sensor.unit[0] != 0)
+            {
+                config += ",\"unit_of_measurement\":";
+                appendJsonString(config, sensor.unit);
+            }
+            if (sensor.deviceClass[0] != 0)
+            {
+                config += ",\"device_class\":";
+                appendJsonString(config, sensor.deviceClass);
+            }
+            config += ",\"state_class\":\"measurement\",\"availability_topic\":";
+            appendJsonString(config, statusTopic);
+            config += ",\"device\":{\"identifiers\":[";
+            appendJsonString(config, clientId);
+            config += "],\"name\":";
+            appendJsonString(config, deviceName);
+            config += ",\"model\":\"CO2 Ampel\",\"sw_version\":";
+            appendJsonString(config, version);
+            config += "}}";
+            std::string configTopic = discoveryPrefix + "/sensor/" + id + "/config";
+            mqtt.publish(configTopic.c_str(), config.c_str(), config.size(), true, 1, mqtt.nextPacketId(), false);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,221 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include <ESPmDNS.h>
+#include <ArduinoJson.h>
+#include <mbedtls/md.h>
+#include "config.h" // provisioningSeq
+
+#ifndef Provisioning_H_
+#define Provisioning_H_
+
+/*
+Fleet provisioning over the local network (see tools/provision.py).
+
+The device advertises _co2ampel._udp over mDNS and broadcasts a hello datagram
+to PROVISIONING_ANNOUNCE_PORT, every few seconds while unconfigured and once a
+minute otherwise. The provisioning tool answers with a bundle on
+PROVISIONING_PORT:
+
+  <hex HMAC-SHA256 of payload with the fleet key>\n<payload>
+
+where payload is {"seq": n, "device": "<chipId or *>", "config": {...}}. The
+config object uses the keys of /config.json plus wifiSSID/wifiPass. Bundles with
+a bad signature, for another device or with a seq not newer than the last applied
+one are rejected. Every bundle is acknowledged to the sender, after a successful
+one the device stores the Wi-Fi credentials and restarts.
+
+Provisioning is only compiled in if the fleet key is set as build flag
+PROVISIONING_KEY.
+*/
+
+#define PROVISIONING_PORT 4210
+#define PROVISIONING_ANNOUNCE_PORT 4211
+#define PROVISIONING_ANNOUNCE_INTERVAL 3000
+#define PROVISIONING_ANNOUNCE_INTERVAL_CONFIGURED 60000
+#define PROVISIONING_MAX_PACKET 1400
+
+// Applies the config object of a verified bundle, returns true if the device has to restart
+typedef bool (*ProvisioningApplyCallback)(JsonObject config);
+
+WiFiUDP provisioningUdp;
+bool provisioningStarted = false;
+bool provisioningRestartPending = false;
+bool provisioningUnconfigured = false;
+unsigned long provisioningAnnounceTimer = 0;
+const char *provisioningKey = nullptr;
+String provisioningChipId;
+String provisioningDeviceName;
+ProvisioningApplyCallback provisioningApply = nullptr;
+String provisioningWifiSSID;
+String provisioningWifiPass;
+
+bool hmacSHA256(const char *key, const uint8_t *data, size_t length, uint8_t *digest)
+{
+    mbedtls_md_context_t ctx;
+    mbedtls_md_init(&ctx);
+    bool ok = mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1) == 0 &&
+              mbedtls_md_hmac_starts(&ctx, (const unsigned char *)key, strlen(key)) == 0 &&
+              mbedtls_md_hmac_update(&ctx, data, length) == 0 &&
+              mbedtls_md_hmac_finish(&ctx, digest) == 0;
+    mbedtls_md_free(&ctx);
+    return ok;
+}
+
+// Compares the hex signature against the HMAC of payload without early exit
+bool verifyProvisioningSignature(const char *signatureHex, size_t signatureLength, const uint8_t *payload, size_t payloadLength)
+{
+    uint8_t digest[32];
+    if (signatureLength != 64 || !hmacSHA256(provisioningKey, payload, payloadLength, digest))
+    {
+        return false;
+    }
+    uint8_t diff = 0;
+    for (int i = 0; i < 32; i++)
+    {
+        char hex[3] = {signatureHex[2 * i], signatureHex[2 * i + 1], 0};
+        diff |= digest[i] ^ (uint8_t)strtoul(hex, nullptr, 16);
+    }
+    return diff == 0;
+}
+
+void sendProvisioningAck(unsigned long seq, const char *error)
+{
+    StaticJsonDocument<192> ack;
+    ack["type"] = "ack";
+    ack["chipId"] = provisioningChipId;
+    ack["seq"] = seq;
+    ack["ok"] = error == nullptr;
+    if (error != nullptr)
+    {
+        ack["error"] = error;
+    }
+    ack["restart"] = provisioningRestartPending;
+
+    provisioningUdp.beginPacket(provisioningUdp.remoteIP(), provisioningUdp.remotePort());
+    serializeJson(ack, provisioningUdp);
+    provisioningUdp.endPacket();
+}
+
+void announceProvisioning()
+{
+    StaticJsonDocument<192> hello;
+    hello["type"] = "hello";
+    hello["device"] = provisioningDeviceName;
+    hello["chipId"] = provisioningChipId;
+    hello["version"] = VERSION;
+    hello["seq"] = provisioningSeq;
+
+    provisioningUdp.beginPacket(IPAddress(255, 255, 255, 255), PROVISIONING_ANNOUNCE_PORT);
+    serializeJson(hello, provisioningUdp);
+    provisioningUdp.endPacket();
+}
+
+void handleProvisioningPacket(int size)
+{
+    static char packet[PROVISIONING_MAX_PACKET + 1];
+    if (size > PROVISIONING_MAX_PACKET)
+    {
+        provisioningUdp.flush();
+        sendProvisioningAck(0, "too large");
+        return;
+    }
+    int length = provisioningUdp.read(packet, PROVISIONING_MAX_PACKET);
+    packet[length < 0 ? 0 : length] = 0;
+
+    char *payload = strchr(packet, '\n');
+    if (payload == nullptr)
+    {
+        sendProvisioningAck(0, "malformed");
+        return;
+    }
+    size_t signatureLength = payload - packet;
+    payload++;
+    if (!verifyProvisioningSignature(packet, signatureLength, (const uint8_t *)payload, strlen(payload)))
+    {
+        sendProvisioningAck(0, "bad signature");
+        return;
+    }
+
+    DynamicJsonDocument bundle(1536);
+    if (deserializeJson(bundle, payload))
+    {
+        sendProvisioningAck(0, "bad json");
+        return;
+    }
+    unsigned long seq = bundle["seq"] | 0UL;
+    const char *device = bundle["device"] | "";
+    if (strcmp(device, "*") != 0 && provisioningChipId != device)
+    {
+        return; // not for us, stay quiet so the tool only hears the target
+    }
+    if (seq <= provisioningSeq)
+    {
+        // a retransmit of the bundle we already applied is fine
+        sendProvisioningAck(seq, seq == provisioningSeq ? nullptr : "stale seq");
+        return;
+    }
+
+    JsonObject config = bundle["config"];
+    provisioningWifiSSID = config["wifiSSID"] | "";
+    provisioningWifiPass = config["wifiPass"] | "";
+    provisioningSeq = seq;
+    provisioningRestartPending = provisioningApply(config) || provisioningWifiSSID != "";
+    sendProvisioningAck(seq, nullptr);
+}
+
+void setupProvisioning(const char *key, const String &chipId, const String &deviceName, ProvisioningApplyCallback apply, bool unconfigured)
+{
+    provisioningKey = key;
+    provisioningUnconfigured = unconfigured;
+    provisioningChipId = chipId;
+    provisioningDeviceName = deviceName;
+    provisioningApply = apply;
+}
+
+// Call from loop(), starts listening once Wi-Fi is up
+void handleProvisioning()
+{
+    if (provisioningKey == nullptr || !WiFi.isConnected())
+    {
+        return;
+    }
+    if (!provisioningStarted)
+    {
+        provisioningUdp.begin(PROVISIONING_PORT);
+        if (MDNS.begin(("co2ampel-" + provisioningChipId).c_str()))
+        {
+            MDNS.addService("co2ampel", "udp", PROVISIONING_PORT);
+            MDNS.addServiceTxt("co2ampel", "udp", "chipId", provisioningChipId.c_str());
+            MDNS.addServiceTxt("co2ampel", "udp", "version", VERSION);
+        }
+        provisioningStarted = true;
+    }
+
+    if (millis() - provisioningAnnounceTimer > (provisioningUnconfigured ? PROVISIONING_ANNOUNCE_INTERVAL : PROVISIONING_ANNOUNCE_INTERVAL_CONFIGURED))
+    {
+        announceProvisioning();
+        provisioningAnnounceTimer = millis();
+    }
+
+    int size = provisioningUdp.parsePacket();
+    if (size > 0)
+    {
+        handleProvisioningPacket(size);
+    }
+
+    if (provisioningRestartPending)
+    {
+        delay(200); // let the ack leave
+        if (provisioningWifiSSID != "")
+        {
+            // stored by the SDK and picked up by WiFiManager after the restart
+            WiFi.persistent(true);
+            WiFi.begin(provisioningWifiSSID.c_str(), provisioningWifiPass.c_str());
+            delay(100);
+        }
+        ESP.restart();
+    }
+}
+
+#endif
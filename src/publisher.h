@@ -0,0 +1,104 @@
+#include <stdint.h>
+#include <string>
+
+#ifndef Publisher_H_
+#define Publisher_H_
+
+/*
+Shared output path for the backends (Influx, MQTT).
+
+Each point is queued once as InfluxDB line protocol. Every backend has its own
+cursors into the queue: next is the point to send, acked the first point the
+other side hasn't confirmed yet (Influx: HTTP 204, MQTT: PUBACK). A backend that
+is offline or slow gets the points it missed in order once it is back, as long
+as they are still in the queue; when the queue is full the oldest points are
+dropped for the backends that are behind.
+
+A backend only moves next ahead of acked by window() points, so a synchronous
+backend sends one point at a time and MQTT keeps a few QoS 1 messages in flight.
+*/
+
+#define PUBLISH_QUEUE_SIZE 32
+#define MAX_PUBLISHERS 4
+
+class Publisher
+{
+public:
+    uint32_t next = 0;         // next point to send
+    uint32_t acked = 0;        // points before this one are confirmed
+    unsigned long dropped = 0; // points that left the queue unconfirmed
+
+    virtual ~Publisher() {}
+    virtual const char *name() const = 0;
+    // Called when there is something to send, connects if needed; a new connection rewinds next to acked
+    virtual bool ready() = 0;
+    // Hands over one point, false if that failed and it should be sent again later.
+    // A synchronous backend moves acked itself when it returns true.
+    virtual bool send(const std::string &line, uint32_t seq) = 0;
+    // Called every loop, collects confirmations and keeps the connection alive
+    virtual void poll() {}
+    virtual uint32_t window() const { return 1; }
+};
+
+struct PublishQueue
+{
+    std::string lines[PUBLISH_QUEUE_SIZE];
+    uint32_t end = 0; // sequence number of the next point
+    Publisher *publishers[MAX_PUBLISHERS];
+    int publisherCount = 0;
+};
+
+PublishQueue publishQueue;
+
+void addPublisher(Publisher *publisher)
+{
+    if (publishQueue.publisherCount < MAX_PUBLISHERS)
+    {
+        publisher->next = publisher->acked = publishQueue.end;
+        publishQueue.publishers[publishQueue.publisherCount++] = publisher;
+    }
+}
+
+void enqueuePoint(const std::string &line)
+{
+    publishQueue.lines[publishQueue.end % PUBLISH_QUEUE_SIZE] = line;
+    publishQueue.end++;
+    if (publishQueue.end <= PUBLISH_QUEUE_SIZE)
+    {
+        return;
+    }
+    uint32_t oldest = publishQueue.end - PUBLISH_QUEUE_SIZE;
+    for (int i = 0; i < publishQueue.publisherCount; i++)
+    {
+        Publisher *p = publishQueue.publishers[i];
+        if (p->acked < oldest)
+        {
+            p->dropped += oldest - p->acked;
+            p->acked = oldest;
+        }
+        if (p->next < oldest)
+        {
+            p->next = oldest;
+        }
+    }
+}
+
+// Call from loop(), sends what each backend can take right now
+void flushPublishers()
+{
+    for (int i = 0; i < publishQueue.publisherCount; i++)
+    {
+        Publisher *p = publishQueue.publishers[i];
+        p->poll();
+        while (p->next < publishQueue.end && p->next - p->acked < p->window() && p->ready())
+        {
+            if (!p->send(publishQueue.lines[p->next % PUBLISH_QUEUE_SIZE], p->next))
+            {
+                break;
+            }
+            p->next++;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,105 @@
+#include <math.h>
+#include "smoothing.h"
+
+#ifndef RoomAnalytics_H_
+#define RoomAnalytics_H_
+
+/*
+Streaming ventilation detection and occupancy estimate from the CO2 readings.
+
+Uses the mass balance of a well mixed room
+
+  dC/dt = G / V - lambda * (C - Cout)
+
+with G the CO2 emitted by the people, V the room volume and lambda the air
+exchange rate. A steep drop of C is a ventilation event; when it ends, lambda of
+the open window follows from the exponential decay towards Cout. Outside of
+events the occupancy is G / (emission per person) with lambda at its leakage
+value. Cout tracks the lowest readings (slowly drifting upwards).
+
+Constant memory and time per reading, samples may come at any interval.
+*/
+
+#define ROOM_DEFAULT_VOLUME 200.0f        // m3, typical classroom
+#define ROOM_LEAKAGE_RATE 0.3f            // 1/h with windows closed
+#define ROOM_PERSON_EMISSION 0.018f       // m3/h CO2 per person (sitting, adult-ish)
+#define ROOM_VENTILATION_SLOPE -25.0f     // ppm/min, steeper drops start an event
+#define ROOM_VENTILATION_END_SLOPE -5.0f  // ppm/min, the event ends once it is flatter
+#define ROOM_MIN_EVENT_DROP 50.0f         // ppm, smaller drops are not counted
+#define ROOM_SLOPE_TAU 15.0f              // s, smoothing of the slope
+#define ROOM_OCCUPANCY_TAU 45.0f          // s, smoothing of the occupancy estimate
+#define ROOM_OUTDOOR_DRIFT 2.0f           // ppm/h the outdoor estimate rises without lower readings
+
+struct RoomAnalytics
+{
+    float volume = ROOM_DEFAULT_VOLUME;
+    float outdoor = 420.0f; // ppm
+    float slope = 0.0f;     // ppm/min, smoothed
+    float occupancy = 0.0f; // persons, smoothed
+    float airExchangeRate = NAN; // 1/h measured at the end of the last ventilation
+    bool ventilating = false;
+    unsigned long ventilationCount = 0;
+    unsigned long lastVentilationEnd = 0; // ms, 0 if none yet
+    // internal state
+    float lastPPM = NAN;
+    unsigned long lastTime = 0;
+    float eventStartPPM = 0.0f;
+    unsigned long eventStartTime = 0;
+};
+
+// Feed a reading taken at now (ms)
+void updateRoomAnalytics(RoomAnalytics &room, float ppm, unsigned long now)
+{
+    if (isnan(room.lastPPM) || now == room.lastTime)
+    {
+        room.lastPPM = ppm;
+        room.lastTime = now;
+        return;
+    }
+    float minutes = (now - room.lastTime) / 60000.0f;
+    float slope = (ppm - room.lastPPM) / minutes;
+    room.slope += smoothingWeight(minutes * 60.0f, ROOM_SLOPE_TAU) * (slope - room.slope);
+
+    room.outdoor += ROOM_OUTDOOR_DRIFT * minutes / 60.0f;
+    if (ppm < room.outdoor)
+    {
+        room.outdoor = ppm;
+    }
+
+    if (!room.ventilating && room.slope < ROOM_VENTILATION_SLOPE)
+    {
+        room.ventilating = true;
+        room.eventStartPPM = room.lastPPM;
+        room.eventStartTime = room.lastTime;
+    }
+    else if (room.ventilating && room.slope > ROOM_VENTILATION_END_SLOPE)
+    {
+        room.ventilating = false;
+        float hours = (now - room.eventStartTime) / 3600000.0f;
+        float startExcess = room.eventStartPPM - room.outdoor;
+        float endExcess = ppm - room.outdoor;
+        if (room.eventStartPPM - ppm >= ROOM_MIN_EVENT_DROP)
+        {
+            room.ventilationCount++;
+            room.lastVentilationEnd = now;
+            if (hours > 0.0f && startExcess > 0.0f && endExcess > 0.0f)
+            {
+                room.airExchangeRate = logf(startExcess / endExcess) / hours;
+            }
+        }
+    }
+
+    if (!room.ventilating)
+    {
+        // emitted CO2 in m3/h from the mass balance with closed windows
+        float emission = room.volume * 1e-6f * (room.slope * 60.0f + ROOM_LEAKAGE_RATE * (ppm - room.outdoor));
+        float persons = emission / ROOM_PERSON_EMISSION;
+        float weight = smoothingWeight(minutes * 60.0f, ROOM_OCCUPANCY_TAU);
+        room.occupancy += weight * ((persons > 0.0f ? persons : 0.0f) - room.occupancy);
+    }
+
+    room.lastPPM = ppm;
+    room.lastTime = now;
+}
+
+#endif
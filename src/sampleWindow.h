@@ -0,0 +1,52 @@
+#ifndef SampleWindow_H_
+#define SampleWindow_H_
+
+/*
+The last SAMPLE_SIZE readings for the drift check in readCO2(). ssDiff is the
+change over the whole window, s1Diff over its last fifth. A fall of more than
+15 ppm per fifth for a whole window that ends more than 400 ppm lower is the
+sensor's baseline running away rather than a room being aired.
+*/
+
+#define SAMPLE_SIZE 30
+
+struct SampleWindow
+{
+    float samples[SAMPLE_SIZE];
+    unsigned int counter = 0; // slot of the next reading
+    unsigned int s1DiffBelowThresholdCount = 0;
+    float ssDiff = 0.0f;
+    float s1Diff = 0.0f;
+};
+
+// readCount counts the readings since boot including this one.
+// Returns true while the readings have been falling steadily for a whole window.
+bool addSample(SampleWindow &w, float ppm, unsigned long readCount)
+{
+    w.samples[w.counter] = ppm;
+    w.ssDiff = 0.0f;
+    w.s1Diff = 0.0f;
+    bool falling = false;
+    if (readCount >= SAMPLE_SIZE)
+    {
+        w.ssDiff = w.samples[w.counter] - w.samples[(w.counter + 1) % SAMPLE_SIZE];
+    }
+    if (readCount > SAMPLE_SIZE / 5)
+    {
+        // + SAMPLE_SIZE keeps the unsigned index from wrapping at the start of the window
+        w.s1Diff = w.samples[w.counter] - w.samples[(w.counter + SAMPLE_SIZE - SAMPLE_SIZE / 5) % SAMPLE_SIZE];
+        if (w.s1Diff < -15.0f)
+        {
+            w.s1DiffBelowThresholdCount++;
+        }
+        else
+        {
+            w.s1DiffBelowThresholdCount = 0;
+        }
+        falling = w.s1DiffBelowThresholdCount >= SAMPLE_SIZE && w.ssDiff < -400.0f;
+    }
+    w.counter = (w.counter + 1) % SAMPLE_SIZE;
+    return falling;
+}
+
+#endif
@@ -0,0 +1,294 @@
+#include <math.h>
+#include "smoothing.h"
+
+#ifndef SensorHealth_H_
+#define SensorHealth_H_
+
+/*
+Health of the CO2 sensor, summarized once per SENSOR_HEALTH_PERIOD so a fleet of
+devices can be triaged from the dashboard instead of in the classroom.
+
+Per period: the share of failed requests to the sensor (UART or I2C), readings
+outside of 0..SENSOR_MAX_PPM, jumps faster than any room changes, the time the
+reading was stuck on exactly the same value and the offset between the sensor's
+own temperature and the BME280. The offset includes the self heating of the
+sensor, so it is compared to its long-term mean instead of zero. The mean stands
+still while the offset is out of tolerance, otherwise a lasting fault would
+become the new normal within hours.
+
+Drift: classrooms get close to outdoor air at night and with open windows, so
+the lowest smoothed reading of a day is a baseline that should stay near
+SENSOR_OUTDOOR_PPM. The baselines of the last SENSOR_DRIFT_DAYS days give the
+offset now and, after SENSOR_DRIFT_TREND_DAYS, its trend; the drift score is the offset projected
+SENSOR_DRIFT_HORIZON days ahead in percent of SENSOR_DRIFT_LIMIT. A room that is
+never aired shows an offset as well, the trend tells both apart. A calibration
+starts the history over.
+
+Constant memory and time per reading.
+*/
+
+#define SENSOR_HEALTH_PERIOD 3600000UL   // ms per health record
+#define SENSOR_HEALTH_DAY 86400000UL     // ms per drift baseline
+#define SENSOR_MAX_PPM 10000.0f          // readings outside of 0..this are invalid
+#define SENSOR_JUMP_PPM 300.0f           // a jump changes the reading by more than this
+#define SENSOR_JUMP_SLOPE 400.0f         // ppm/min, and faster than airing or a full room
+#define SENSOR_STUCK_TIME 1800000UL      // ms the exact same value has to repeat to count as stuck
+#define SENSOR_MAX_ERROR_RATE 0.1f       // failed requests per request
+#define SENSOR_MAX_IMPLAUSIBLE 3         // invalid readings and jumps per period
+#define SENSOR_TEMP_TOLERANCE 3.0f       // °C the temperature offset may move from its mean
+#define SENSOR_TEMP_ALPHA 0.05f          // per period, long-term mean of the temperature offset
+#define SENSOR_BASELINE_TAU 270.0f       // s, smoothing of the readings for the daily minimum
+#define SENSOR_OUTDOOR_PPM 420.0f
+#define SENSOR_DRIFT_DAYS 14
+#define SENSOR_DRIFT_TREND_DAYS 7        // baselines needed before the trend counts, fewer are too noisy
+#define SENSOR_DRIFT_HORIZON 30.0f       // days
+#define SENSOR_DRIFT_LIMIT 200.0f        // ppm
+#define SENSOR_DRIFT_WARN 50.0f          // drift score
+#define SENSOR_CALIBRATION_GAP 3600000UL // ms, repeated calibrations within this count once
+
+struct HealthRecord
+{
+    const char *status = "ok"; // worst finding: silent, errors, implausible, stuck, temp, drift or ok
+    unsigned long transactions = 0;
+    unsigned long failures = 0;
+    float errorRate = 0.0f;
+    unsigned long readings = 0;
+    unsigned long invalid = 0;
+    unsigned long jumps = 0;
+    unsigned long stuckMinutes = 0;
+    float tempOffset = NAN;    // °C, sensor minus BME280, mean of the period
+    float tempDeviation = NAN; // °C, tempOffset minus its long-term mean
+    float baseline = NAN;      // ppm, mean of the last three daily minimums
+    float drift = NAN;         // ppm, baseline minus SENSOR_OUTDOOR_PPM
+    float driftSlope = NAN;    // ppm/day
+    float driftScore = NAN;    // %
+    int baselineDays = 0;
+    unsigned long calibrations = 0;
+};
+
+struct SensorHealth
+{
+    HealthRecord record;                // the last finished period
+    float baselines[SENSOR_DRIFT_DAYS]; // ppm, daily minimums, oldest first
+    int baselineCount = 0;
+    unsigned long calibrations = 0;
+    float dayMin = NAN;         // ppm, lowest smoothed reading of the current day
+    unsigned long dayStart = 0; // ms
+    float tempMean = NAN;       // °C, long-term mean of the temperature offset
+    unsigned long tempPeriods = 0;
+    // internal state
+    unsigned long periodStart = 0;
+    unsigned long periodTransactions = 0; // sensor counters at periodStart
+    unsigned long periodFailures = 0;
+    unsigned long readings = 0;
+    unsigned long invalid = 0;
+    unsigned long jumps = 0;
+    unsigned long stuckTime = 0; // ms
+    float tempOffsetSum = 0.0f;
+    unsigned long tempCount = 0;
+    float lastPPM = NAN;
+    unsigned long lastTime = 0;
+    unsigned long sameSince = 0; // ms, first reading of the current run of identical values
+    float smoothed = NAN;
+    unsigned long lastCalibration = 0;
+};
+
+void addBaseline(SensorHealth &h, float ppm)
+{
+    if (h.baselineCount == SENSOR_DRIFT_DAYS)
+    {
+        for (int i = 1; i < SENSOR_DRIFT_DAYS; i++)
+        {
+            h.baselines[i - 1] = h.baselines[i];
+        }
+        h.baselineCount--;
+    }
+    h.baselines[h.baselineCount++] = ppm;
+}
+
+// Feed every reading of the sensor taken at now (ms). sensorTemp is the CO2
+// sensor's temperature, ambientTemp the BME280, NAN if there is none.
+void updateSensorHealth(SensorHealth &h, float ppm, float sensorTemp, float ambientTemp, unsigned long now)
+{
+    if (now - h.dayStart >= SENSOR_HEALTH_DAY)
+    {
+        if (!isnan(h.dayMin))
+        {
+            addBaseline(h, h.dayMin);
+        }
+        h.dayMin = NAN;
+        h.dayStart = now;
+    }
+
+    h.readings++;
+    if (!(ppm > 0.0f && ppm < SENSOR_MAX_PPM))
+    {
+        h.invalid++;
+        return;
+    }
+
+    bool jump = false;
+    if (!isnan(h.lastPPM))
+    {
+        float minutes = (now - h.lastTime) / 60000.0f;
+        float change = fabsf(ppm - h.lastPPM);
+        jump = change > SENSOR_JUMP_PPM && (minutes <= 0.0f || change / minutes > SENSOR_JUMP_SLOPE);
+        h.jumps += jump ? 1 : 0;
+
+        if (ppm != h.lastPPM)
+        {
+            h.sameSince = now;
+        }
+        else if (now - h.sameSince >= SENSOR_STUCK_TIME)
+        {
+            h.stuckTime += now - h.lastTime;
+        }
+    }
+    else
+    {
+        h.sameSince = now;
+    }
+
+    // spikes stay out of the baseline
+    if (!jump)
+    {
+        float weight = smoothingWeight((now - h.lastTime) / 1000.0f, SENSOR_BASELINE_TAU);
+        h.smoothed = isnan(h.smoothed) ? ppm : h.smoothed + weight * (ppm - h.smoothed);
+        if (isnan(h.dayMin) || h.smoothed < h.dayMin)
+        {
+            h.dayMin = h.smoothed;
+        }
+    }
+
+    if (!isnan(sensorTemp) && !isnan(ambientTemp))
+    {
+        h.tempOffsetSum += sensorTemp - ambientTemp;
+        h.tempCount++;
+    }
+
+    h.lastPPM = ppm;
+    h.lastTime = now;
+}
+
+// Call whenever the sensor is calibrated, the drift history starts over
+void noteSensorCalibration(SensorHealth &h, unsigned long now)
+{
+    if (h.calibrations == 0 || now - h.lastCalibration >= SENSOR_CALIBRATION_GAP)
+    {
+        h.calibrations++;
+    }
+    h.lastCalibration = now;
+    h.baselineCount = 0;
+    h.dayMin = NAN;
+    h.smoothed = NAN;
+}
+
+void updateDrift(SensorHealth &h, HealthRecord &r)
+{
+    r.baselineDays = h.baselineCount;
+    if (h.baselineCount == 0)
+    {
+        r.baseline = r.drift = r.driftSlope = r.driftScore = NAN;
+        return;
+    }
+    int recent = h.baselineCount < 3 ? h.baselineCount : 3;
+    float sum = 0.0f;
+    for (int i = h.baselineCount - recent; i < h.baselineCount; i++)
+    {
+        sum += h.baselines[i];
+    }
+    r.baseline = sum / recent;
+    r.drift = r.baseline - SENSOR_OUTDOOR_PPM;
+
+    // least squares slope over the days
+    r.driftSlope = 0.0f;
+    if (h.baselineCount >= SENSOR_DRIFT_TREND_DAYS)
+    {
+        float n = h.baselineCount;
+        float meanX = (n - 1.0f) / 2.0f;
+        float meanY = 0.0f;
+        for (int i = 0; i < h.baselineCount; i++)
+        {
+            meanY += h.baselines[i] / n;
+        }
+        float sxy = 0.0f;
+        float sxx = 0.0f;
+        for (int i = 0; i < h.baselineCount; i++)
+        {
+            sxy += (i - meanX) * (h.baselines[i] - meanY);
+            sxx += (i - meanX) * (i - meanX);
+        }
+        r.driftSlope = sxy / sxx;
+    }
+    r.driftScore = 100.0f * fabsf(r.drift + r.driftSlope * SENSOR_DRIFT_HORIZON) / SENSOR_DRIFT_LIMIT;
+}
+
+// Call from loop() with the sensor's counters since boot. Returns true once per
+// SENSOR_HEALTH_PERIOD, h.record then holds the finished period.
+bool sensorHealthDue(SensorHealth &h, unsigned long transactions, unsigned long failures, unsigned long now)
+{
+    if (now - h.periodStart < SENSOR_HEALTH_PERIOD)
+    {
+        return false;
+    }
+    HealthRecord &r = h.record;
+    r.transactions = transactions - h.periodTransactions;
+    r.failures = failures - h.periodFailures;
+    r.errorRate = r.transactions > 0 ? (float)r.failures / r.transactions : 0.0f;
+    r.readings = h.readings;
+    r.invalid = h.invalid;
+    r.jumps = h.jumps;
+    r.stuckMinutes = h.stuckTime / 60000;
+    r.calibrations = h.calibrations;
+
+    r.tempOffset = h.tempCount > 0 ? h.tempOffsetSum / h.tempCount : NAN;
+    r.tempDeviation = isnan(r.tempOffset) || isnan(h.tempMean) ? NAN : r.tempOffset - h.tempMean;
+    if (!isnan(r.tempOffset) && !(fabsf(r.tempDeviation) > SENSOR_TEMP_TOLERANCE))
+    {
+        // plain mean for the first periods, the slow average takes too long to settle after a boot
+        h.tempPeriods++;
+        float alpha = 1.0f / h.tempPeriods > SENSOR_TEMP_ALPHA ? 1.0f / h.tempPeriods : SENSOR_TEMP_ALPHA;
+        h.tempMean = isnan(h.tempMean) ? r.tempOffset : h.tempMean + alpha * (r.tempOffset - h.tempMean);
+    }
+
+    updateDrift(h, r);
+
+    if (r.readings == 0)
+    {
+        r.status = "silent";
+    }
+    else if (r.errorRate > SENSOR_MAX_ERROR_RATE)
+    {
+        r.status = "errors";
+    }
+    else if (r.invalid + r.jumps > SENSOR_MAX_IMPLAUSIBLE)
+    {
+        r.status = "implausible";
+    }
+    else if (r.stuckMinutes > 0)
+    {
+        r.status = "stuck";
+    }
+    else if (fabsf(r.tempDeviation) > SENSOR_TEMP_TOLERANCE)
+    {
+        r.status = "temp";
+    }
+    else if (r.driftScore >= SENSOR_DRIFT_WARN)
+    {
+        r.status = "drift";
+    }
+    else
+    {
+        r.status = "ok";
+    }
+
+    h.periodStart = now;
+    h.periodTransactions = transactions;
+    h.periodFailures = failures;
+    h.readings = h.invalid = h.jumps = h.stuckTime = 0;
+    h.tempOffsetSum = 0.0f;
+    h.tempCount = 0;
+    return true;
+}
+
+#endif
@@ -0,0 +1,66 @@
+#include "co2Sensor.h"
+#include "MHZ19.h"
+
+#ifndef SensorMHZ19_H_
+#define SensorMHZ19_H_
+
+// Winsen MH-Z19B/C on UART, wraps the MH-Z19 library. The library waits for the
+// answer of each request (a few ms at 9600 baud), so poll() only talks to the
+// sensor once per measurement period.
+class MHZ19Sensor : public CO2Sensor
+{
+public:
+    explicit MHZ19Sensor(Stream &serial) : serial(serial) {}
+
+    const char *name() const override { return "MH-Z19"; }
+    uint8_t capabilities() const override
+    {
+        return SENSOR_CAP_CO2 | SENSOR_CAP_TEMPERATURE | SENSOR_CAP_NATIVE_ABC | SENSOR_CAP_FORCED_CALIBRATION |
+               SENSOR_CAP_FIRMWARE_CALIBRATION;
+    }
+    unsigned long measurementPeriod() const override { return 5000; }
+
+    bool begin() override
+    {
+        drainStream(serial);
+        mhz19.begin(serial);
+        isOK = mhz19.errorCode == RESULT_OK;
+        if (isOK)
+        {
+            mhz19.setRange(5000);
+        }
+        return isOK;
+    }
+
+    bool poll(SensorReading &reading) override
+    {
+        if (lastPoll != 0 && millis() - lastPoll < measurementPeriod())
+        {
+            return false;
+        }
+        lastPoll = millis();
+
+        reading.co2 = mhz19.getCO2();
+        bool co2OK = countTransaction(mhz19.errorCode == RESULT_OK);
+        reading.temperature = mhz19.getTemperature();
+        reading.humidity = NAN;
+        isOK = countTransaction(mhz19.errorCode == RESULT_OK) && co2OK;
+        return isOK;
+    }
+
+    bool calibrate(uint16_t /* ppm */) override
+    {
+        // zero point calibration of the MH-Z19 is always 400 ppm
+        mhz19.calibrate();
+        return mhz19.errorCode == RESULT_OK;
+    }
+
+    void setNativeABC(bool enabled) override { mhz19.autoCalibration(enabled); }
+
+private:
+    Stream &serial;
+    MHZ19 mhz19;
+    unsigned long lastPoll = 0;
+};
+
+#endif
@@ -0,0 +1,153 @@
+#include "co2Sensor.h"
+
+#ifndef SensorS8_H_
+#define SensorS8_H_
+
+#define S8_ADDRESS 0xFE // "any sensor" address
+#define S8_READ_INPUT 0x04
+#define S8_WRITE_HOLDING 0x06
+#define S8_RESPONSE_TIMEOUT 180
+
+uint16_t modbusCRC(const uint8_t *data, int len)
+{
+    uint16_t crc = 0xFFFF;
+    for (int i = 0; i < len; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x0001) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+// SenseAir S8 on UART (Modbus RTU, 9600 8N1). Reads input registers IR1 (meter
+// status) to IR4 (CO2) with one request, the answer is collected on the next poll.
+class S8Sensor : public CO2Sensor
+{
+public:
+    explicit S8Sensor(Stream &serial) : serial(serial) {}
+
+    const char *name() const override { return "SenseAir S8"; }
+    uint8_t capabilities() const override
+    {
+        return SENSOR_CAP_CO2 | SENSOR_CAP_NATIVE_ABC | SENSOR_CAP_FORCED_CALIBRATION;
+    }
+    unsigned long measurementPeriod() const override { return 4000; }
+
+    bool begin() override
+    {
+        uint8_t response[13];
+        isOK = transact(S8_READ_INPUT, 0x0000, 4, response, sizeof(response)) && parseReading(response, lastCO2);
+        return isOK;
+    }
+
+    bool poll(SensorReading &reading) override
+    {
+        if (requestTimer == 0)
+        {
+            if (lastPoll != 0 && millis() - lastPoll < measurementPeriod())
+            {
+                return false;
+            }
+            lastPoll = millis();
+            sendRequest(S8_READ_INPUT, 0x0000, 4);
+            requestTimer = millis();
+            received = 0;
+            return false;
+        }
+
+        while (serial.available() && received < sizeof(rxBuffer))
+        {
+            rxBuffer[received++] = serial.read();
+        }
+        if (received < 13)
+        {
+            if (millis() - requestTimer > S8_RESPONSE_TIMEOUT)
+            {
+                requestTimer = 0;
+                isOK = countTransaction(false);
+            }
+            return false;
+        }
+        requestTimer = 0;
+
+        isOK = countTransaction(parseReading(rxBuffer, lastCO2));
+        if (isOK)
+        {
+            reading.co2 = lastCO2;
+            reading.temperature = NAN;
+            reading.humidity = NAN;
+        }
+        return isOK;
+    }
+
+    bool calibrate(uint16_t /* ppm */) override
+    {
+        // The S8 only supports background calibration (400 ppm), clear the
+        // acknowledgement register HR1 and send the command to HR2
+        uint8_t response[8];
+        requestTimer = 0;
+        return transact(S8_WRITE_HOLDING, 0x0000, 0x0000, response, sizeof(response)) &&
+               transact(S8_WRITE_HOLDING, 0x0001, 0x7C06, response, sizeof(response));
+    }
+
+    void setNativeABC(bool enabled) override
+    {
+        // HR32 holds the ABC period in hours, 0 disables it
+        uint8_t response[8];
+        requestTimer = 0;
+        transact(S8_WRITE_HOLDING, 0x001F, enabled ? 180 : 0, response, sizeof(response));
+    }
+
+private:
+    Stream &serial;
+    uint8_t rxBuffer[13];
+    size_t received = 0;
+    unsigned long requestTimer = 0;
+    unsigned long lastPoll = 0;
+    float lastCO2 = 0.0f;
+
+    void sendRequest(uint8_t function, uint16_t address, uint16_t value)
+    {
+        uint8_t frame[8] = {S8_ADDRESS, function,
+                            (uint8_t)(address >> 8), (uint8_t)address,
+                            (uint8_t)(value >> 8), (uint8_t)value};
+        uint16_t crc = modbusCRC(frame, 6);
+        frame[6] = crc & 0xFF;
+        frame[7] = crc >> 8;
+
+        drainStream(serial); // leftovers of an earlier answer
+        serial.write(frame, sizeof(frame));
+    }
+
+    // Blocking request/answer, only used at boot and for configuration
+    bool transact(uint8_t function, uint16_t address, uint16_t value, uint8_t *response, size_t length)
+    {
+        sendRequest(function, address, value);
+        size_t count = 0;
+        unsigned long start = millis();
+        while (count < length && millis() - start < S8_RESPONSE_TIMEOUT)
+        {
+            if (serial.available())
+            {
+                response[count++] = serial.read();
+            }
+        }
+        return count == length && response[1] == function && modbusCRC(response, length - 2) == (response[length - 2] | response[length - 1] << 8);
+    }
+
+    static bool parseReading(const uint8_t *response, float &co2)
+    {
+        if (response[1] != S8_READ_INPUT || response[2] != 8 || modbusCRC(response, 11) != (response[11] | response[12] << 8))
+        {
+            return false;
+        }
+        uint16_t status = response[3] << 8 | response[4];
+        co2 = (int16_t)(response[9] << 8 | response[10]);
+        return status == 0; // any bit set is an error reported by the sensor
+    }
+};
+
+#endif
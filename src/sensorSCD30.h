@@ -0,0 +1,94 @@
+#include "sensorSensirion.h"
+#include <string.h>
+
+#ifndef SensorSCD30_H_
+#define SensorSCD30_H_
+
+#define SCD30_ADDRESS 0x61
+#define SCD30_START_CONTINUOUS 0x0010
+#define SCD30_SET_INTERVAL 0x4600
+#define SCD30_DATA_READY 0x0202
+#define SCD30_READ_MEASUREMENT 0x0300
+#define SCD30_SET_ASC 0x5306
+#define SCD30_FORCED_RECALIBRATION 0x5204
+
+// Sensirion SCD30 on I2C in continuous mode (one value every 2 s). The SCD30 needs
+// a few ms between command and read and uses clock stretching.
+class SCD30Sensor : public SensirionSensor
+{
+public:
+    explicit SCD30Sensor(TwoWire &wire) : SensirionSensor(wire, SCD30_ADDRESS) {}
+
+    const char *name() const override { return "SCD30"; }
+    uint8_t capabilities() const override
+    {
+        return SENSOR_CAP_CO2 | SENSOR_CAP_TEMPERATURE | SENSOR_CAP_HUMIDITY | SENSOR_CAP_NATIVE_ABC | SENSOR_CAP_FORCED_CALIBRATION;
+    }
+    unsigned long measurementPeriod() const override { return 2000; }
+
+    bool begin() override
+    {
+        if (!probe())
+        {
+            return false;
+        }
+        sendCommand(SCD30_SET_INTERVAL, measurementPeriod() / 1000);
+        delay(3);
+        isOK = sendCommand(SCD30_START_CONTINUOUS, 0); // 0 -> no pressure compensation
+        return isOK;
+    }
+
+    bool poll(SensorReading &reading) override
+    {
+        if (millis() - lastPoll < 500)
+        {
+            return false;
+        }
+        lastPoll = millis();
+
+        uint16_t ready;
+        if (!countTransaction(readCommand(SCD30_DATA_READY, &ready, 1, 3)))
+        {
+            isOK = false;
+            return false;
+        }
+        if (ready != 1)
+        {
+            return false;
+        }
+
+        uint16_t words[6];
+        isOK = countTransaction(readCommand(SCD30_READ_MEASUREMENT, words, 6, 3));
+        if (isOK)
+        {
+            reading.co2 = toFloat(words[0], words[1]);
+            reading.temperature = toFloat(words[2], words[3]);
+            reading.humidity = toFloat(words[4], words[5]);
+        }
+        return isOK;
+    }
+
+    bool calibrate(uint16_t ppm) override
+    {
+        return sendCommand(SCD30_FORCED_RECALIBRATION, ppm);
+    }
+
+    void setNativeABC(bool enabled) override
+    {
+        sendCommand(SCD30_SET_ASC, enabled ? 1 : 0);
+    }
+
+private:
+    unsigned long lastPoll = 0;
+
+    // values are big endian IEEE754 floats split in two words
+    static float toFloat(uint16_t high, uint16_t low)
+    {
+        uint32_t bits = (uint32_t)high << 16 | low;
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+};
+
+#endif
@@ -0,0 +1,98 @@
+#include "sensorSensirion.h"
+
+#ifndef SensorSCD4x_H_
+#define SensorSCD4x_H_
+
+#define SCD4X_ADDRESS 0x62
+#define SCD4X_START_PERIODIC 0x21B1
+#define SCD4X_STOP_PERIODIC 0x3F86
+#define SCD4X_DATA_READY 0xE4B8
+#define SCD4X_READ_MEASUREMENT 0xEC05
+#define SCD4X_SET_ASC 0x2416
+#define SCD4X_FORCED_RECALIBRATION 0x362F
+
+// Sensirion SCD40/SCD41 on I2C in periodic measurement mode (one value every 5 s)
+class SCD4xSensor : public SensirionSensor
+{
+public:
+    explicit SCD4xSensor(TwoWire &wire) : SensirionSensor(wire, SCD4X_ADDRESS) {}
+
+    const char *name() const override { return "SCD4x"; }
+    uint8_t capabilities() const override
+    {
+        return SENSOR_CAP_CO2 | SENSOR_CAP_TEMPERATURE | SENSOR_CAP_HUMIDITY | SENSOR_CAP_NATIVE_ABC | SENSOR_CAP_FORCED_CALIBRATION;
+    }
+    unsigned long measurementPeriod() const override { return 5000; }
+
+    bool begin() override
+    {
+        if (!probe())
+        {
+            return false;
+        }
+        // the sensor keeps measuring across an ESP reset, it only accepts configuration when idle
+        sendCommand(SCD4X_STOP_PERIODIC);
+        delay(500);
+        isOK = sendCommand(SCD4X_START_PERIODIC);
+        return isOK;
+    }
+
+    bool poll(SensorReading &reading) override
+    {
+        if (millis() - lastPoll < 1000)
+        {
+            return false;
+        }
+        lastPoll = millis();
+
+        uint16_t status;
+        if (!countTransaction(readCommand(SCD4X_DATA_READY, &status, 1, 1)))
+        {
+            isOK = false;
+            return false;
+        }
+        if ((status & 0x07FF) == 0)
+        {
+            return false; // no new measurement yet
+        }
+
+        uint16_t words[3];
+        isOK = countTransaction(readCommand(SCD4X_READ_MEASUREMENT, words, 3, 1));
+        if (isOK)
+        {
+            reading.co2 = words[0];
+            reading.temperature = -45.0f + 175.0f * words[1] / 65535.0f;
+            reading.humidity = 100.0f * words[2] / 65535.0f;
+        }
+        return isOK;
+    }
+
+    bool calibrate(uint16_t ppm) override
+    {
+        sendCommand(SCD4X_STOP_PERIODIC);
+        delay(500);
+        uint16_t correction = 0xFFFF;
+        bool success = sendCommand(SCD4X_FORCED_RECALIBRATION, ppm);
+        if (success)
+        {
+            delay(400);
+            success = readWords(&correction, 1) && correction != 0xFFFF;
+        }
+        sendCommand(SCD4X_START_PERIODIC);
+        return success;
+    }
+
+    void setNativeABC(bool enabled) override
+    {
+        sendCommand(SCD4X_STOP_PERIODIC);
+        delay(500);
+        sendCommand(SCD4X_SET_ASC, enabled ? 1 : 0);
+        delay(1);
+        sendCommand(SCD4X_START_PERIODIC);
+    }
+
+private:
+    unsigned long lastPoll = 0;
+};
+
+#endif
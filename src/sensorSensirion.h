@@ -0,0 +1,91 @@
+#include "co2Sensor.h"
+#include <Wire.h>
+
+#ifndef SensorSensirion_H_
+#define SensorSensirion_H_
+
+// Framing shared by the Sensirion I2C sensors (SCD30, SCD4x): 16 bit commands,
+// every 16 bit data word is followed by a CRC-8 (polynomial 0x31, init 0xFF).
+uint8_t sensirionCRC(const uint8_t *data, int len)
+{
+    uint8_t crc = 0xFF;
+    for (int i = 0; i < len; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x31 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+class SensirionSensor : public CO2Sensor
+{
+public:
+    SensirionSensor(TwoWire &wire, uint8_t address) : wire(wire), address(address) {}
+
+protected:
+    TwoWire &wire;
+    uint8_t address;
+
+    bool probe()
+    {
+        wire.beginTransmission(address);
+        return wire.endTransmission() == 0;
+    }
+
+    bool sendCommand(uint16_t command)
+    {
+        wire.beginTransmission(address);
+        wire.write(command >> 8);
+        wire.write(command & 0xFF);
+        return wire.endTransmission() == 0;
+    }
+
+    bool sendCommand(uint16_t command, uint16_t argument)
+    {
+        uint8_t data[2] = {(uint8_t)(argument >> 8), (uint8_t)argument};
+        wire.beginTransmission(address);
+        wire.write(command >> 8);
+        wire.write(command & 0xFF);
+        wire.write(data, 2);
+        wire.write(sensirionCRC(data, 2));
+        return wire.endTransmission() == 0;
+    }
+
+    bool readWords(uint16_t *words, int count)
+    {
+        if (wire.requestFrom(address, (uint8_t)(count * 3)) != count * 3)
+        {
+            return false;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            uint8_t data[3];
+            for (int j = 0; j < 3; j++)
+            {
+                data[j] = wire.read();
+            }
+            if (sensirionCRC(data, 2) != data[2])
+            {
+                return false;
+            }
+            words[i] = data[0] << 8 | data[1];
+        }
+        return true;
+    }
+
+    // Send a read command and collect the answer after the sensor's processing time
+    bool readCommand(uint16_t command, uint16_t *words, int count, unsigned long processingTime)
+    {
+        if (!sendCommand(command))
+        {
+            return false;
+        }
+        delay(processingTime);
+        return readWords(words, count);
+    }
+};
+
+#endif
@@ -0,0 +1,19 @@
+#include <math.h>
+
+#ifndef Smoothing_H_
+#define Smoothing_H_
+
+/*
+Exponential moving averages over readings that come at varying intervals (the
+adaptive sampler stretches them from 10 s to minutes). A fixed weight per reading
+would make the time constant grow with the interval; weighting a new value by
+1 - exp(-elapsed / tau) keeps it at tau whatever the spacing.
+*/
+
+// Weight of a value that arrives elapsed seconds after the previous one
+float smoothingWeight(float elapsed, float tau)
+{
+    return elapsed > 0.0f ? 1.0f - expf(-elapsed / tau) : 0.0f;
+}
+
+#endif
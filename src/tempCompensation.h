@@ -0,0 +1,77 @@
+#include <math.h>
+#include <FastLED.h>
+#include "smoothing.h"
+
+#ifndef TempCompensation_H_
+#define TempCompensation_H_
+
+/*
+Self-heating model for the BME280 inside the case.
+
+The static offset (tempOffsetBME) only fits one operating point. The board warms
+up after boot, the LEDs and the radio add heat depending on how much they are used
+and the MH-Z19 internal temperature follows the case temperature. The predicted
+self-heating is
+
+  warm * (1 - exp(-uptime / tau)) + led * ledDuty + radio * radioDuty + mhz * (mhzTemp - staticTemp)
+
+and gets subtracted on top of the static offset. staticTemp is the BME280 with
+only the static offset applied, the same input the fit sees. The coefficients are fitted offline
+with tools/fit_temp_compensation.py from traces recorded with the fields this
+firmware publishes (uptime, ledDuty, radioDuty, mhzTemp, temp) and a reference
+thermometer. All coefficients default to 0, so an unfitted device behaves as before.
+*/
+
+// Time constant of the running duty averages, about the thermal lag of the case
+#define TEMP_MODEL_DUTY_TAU 180.0f // s
+
+struct TempModel
+{
+    float warm = 0.0f;     // °C of warm-up heating after boot
+    float tau = 1800.0f;   // s, warm-up time constant
+    float led = 0.0f;      // °C at 100 % LED duty
+    float radio = 0.0f;    // °C at 100 % radio duty
+    float mhz = 0.0f;      // °C per °C difference between MH-Z19 and BME280
+};
+
+TempModel tempModel;
+float ledDuty = 0.0f;
+float radioDuty = 0.0f;
+unsigned long dutyUpdateTime = 0; // ms
+
+// Average brightness of all LED channels, 0.0 .. 1.0
+float frameDuty(const CRGB *frame, int count)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < count; i++)
+    {
+        sum += frame[i].r + frame[i].g + frame[i].b;
+    }
+    return sum / (count * 3.0f * 255.0f);
+}
+
+// Call with every reading taken at now (ms)
+void updateSelfHeatingInputs(float currentLedDuty, bool radioOn, unsigned long now)
+{
+    float weight = smoothingWeight((now - dutyUpdateTime) / 1000.0f, TEMP_MODEL_DUTY_TAU);
+    dutyUpdateTime = now;
+    ledDuty += weight * (currentLedDuty - ledDuty);
+    radioDuty += weight * ((radioOn ? 1.0f : 0.0f) - radioDuty);
+}
+
+// Predicted self-heating in °C (positive means the sensor reads too warm)
+float predictSelfHeating(const TempModel &model, float uptimeSeconds, float mhzTemp, float staticTemp)
+{
+    float heating = model.led * ledDuty + model.radio * radioDuty;
+    if (model.tau > 0.0f)
+    {
+        heating += model.warm * (1.0f - expf(-uptimeSeconds / model.tau));
+    }
+    if (!isnan(staticTemp) && mhzTemp > -40.0f && mhzTemp < 85.0f) // MH-Z19 reports garbage while warming up
+    {
+        heating += model.mhz * (mhzTemp - staticTemp);
+    }
+    return heating;
+}
+
+#endif
@@ -0,0 +1,373 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_wifi.h>
+#include <esp_system.h>
+#include <ArduinoJson.h>
+#include <SPIFFS.h>
+
+#ifndef WiFiConnection_H_
+#define WiFiConnection_H_
+
+/*
+Keeps the Wi-Fi connection up without the SDK's auto reconnect.
+
+Most of a (re)connect is the scan over all channels. The BSSID and channel of
+the last access point are kept in /wifi.json (written only when they change), so
+both the first connect after boot and reconnects try a direct association with
+them first and only fall back to a full connect with scan if that doesn't work
+within WIFI_FAST_TIMEOUT. Failed attempts back off exponentially with +-
+WIFI_JITTER percent, so a classroom of devices doesn't hit an access point that
+comes back from a reboot all at the same moment.
+
+While connected the RSSI is checked every WIFI_RSSI_CHECK. After WIFI_ROAM_CHECKS
+weak readings an asynchronous scan looks for an access point of the same network
+that is at least WIFI_ROAM_GAIN stronger and switches to it.
+
+The last address is not reused without DHCP: on shared school networks a
+static reconnect can't renew the lease and risks address conflicts.
+
+wifiStats holds the connect time and outage durations for the Influx point.
+Credentials stay in the Wi-Fi NVS where WiFiManager put them. They are read
+again before every attempt, so new ones from the portal or a provisioning bundle
+are used without a reboot, and the attempts here never write the NVS.
+*/
+
+#define WIFI_FAST_TIMEOUT 3000     // ms for a direct association with the cached access point
+#define WIFI_CONNECT_TIMEOUT 15000 // ms for a connect with scan
+#define WIFI_BACKOFF_MIN 1000      // ms
+#define WIFI_BACKOFF_MAX 300000    // ms
+#define WIFI_JITTER 25             // +- percent of the backoff
+#define WIFI_RSSI_CHECK 30000      // ms
+#define WIFI_ROAM_RSSI -75         // dBm, look for a better access point below this
+#define WIFI_ROAM_GAIN 8           // dB the new access point has to be stronger
+#define WIFI_ROAM_CHECKS 3         // consecutive weak checks before scanning
+
+enum WiFiConnectionState
+{
+    WIFI_CONN_IDLE, // not started
+    WIFI_CONN_CONNECTED,
+    WIFI_CONN_CONNECTING,
+    WIFI_CONN_WAITING, // backoff after a failed attempt
+    WIFI_CONN_SCANNING // looking for a stronger access point
+};
+
+struct WiFiStats
+{
+    unsigned long lastConnectMs = 0; // duration of the last successful connect
+    unsigned long outages = 0;
+    unsigned long lastOutageMs = 0;
+    unsigned long totalOutageMs = 0;
+    unsigned long reconnects = 0;
+    unsigned long roams = 0;
+    unsigned long failedAttempts = 0;
+};
+
+WiFiStats wifiStats;
+WiFiConnectionState wifiState = WIFI_CONN_IDLE;
+String wifiSSID;
+String wifiPass;
+uint8_t wifiBSSID[6];
+int32_t wifiChannel = 0; // 0: no cached access point
+bool wifiFastAttempt = false;
+unsigned long wifiAttemptStart = 0;
+unsigned long wifiOutageStart = 0; // 0: no outage
+unsigned long wifiWaitStart = 0;
+unsigned long wifiBackoff = 0;
+unsigned int wifiAttempts = 0;
+unsigned long wifiRSSICheckTimer = 0;
+unsigned int wifiWeakChecks = 0;
+
+bool parseBSSID(const char *text, uint8_t *bssid)
+{
+    unsigned int b[6];
+    if (sscanf(text, "%2x:%2x:%2x:%2x:%2x:%2x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6)
+    {
+        return false;
+    }
+    for (int i = 0; i < 6; i++)
+    {
+        bssid[i] = b[i];
+    }
+    return true;
+}
+
+void loadWiFiCache()
+{
+    File file = SPIFFS.open("/wifi.json", "r");
+    if (!file)
+    {
+        return;
+    }
+    DynamicJsonDocument doc(256);
+    // only valid for the network the credentials are for
+    if (deserializeJson(doc, file) == DeserializationError::Ok && wifiSSID == (doc["ssid"] | "") &&
+        parseBSSID(doc["bssid"] | "", wifiBSSID))
+    {
+        wifiChannel = doc["channel"] | 0;
+    }
+    file.close();
+}
+
+void storeWiFiCache()
+{
+    DynamicJsonDocument doc(256);
+    char bssid[18];
+    snprintf(bssid, sizeof(bssid), "%02x:%02x:%02x:%02x:%02x:%02x", wifiBSSID[0], wifiBSSID[1], wifiBSSID[2],
+             wifiBSSID[3], wifiBSSID[4], wifiBSSID[5]);
+    doc["ssid"] = wifiSSID;
+    doc["bssid"] = bssid;
+    doc["channel"] = wifiChannel;
+    File file = SPIFFS.open("/wifi.json", "w");
+    if (!file)
+    {
+        Serial.println("failed to open /wifi.json for writing");
+        return;
+    }
+    serializeJson(doc, file);
+    file.close();
+}
+
+// Credentials of the last WiFi.begin()/WiFiManager connect, false if there are none
+bool loadWiFiCredentials()
+{
+    wifi_config_t config;
+    if (esp_wifi_get_config(WIFI_IF_STA, &config) != ESP_OK || config.sta.ssid[0] == 0)
+    {
+        return false;
+    }
+    String ssid = String((const char *)config.sta.ssid).substring(0, sizeof(config.sta.ssid));
+    if (ssid != wifiSSID)
+    {
+        // the cached access point belongs to the old network
+        wifiChannel = 0;
+    }
+    wifiSSID = ssid;
+    wifiPass = String((const char *)config.sta.password).substring(0, sizeof(config.sta.password));
+    return true;
+}
+
+void startWiFiAttempt(unsigned long now, bool fast)
+{
+    loadWiFiCredentials();
+    wifiFastAttempt = fast && wifiChannel > 0;
+    wifiAttemptStart = now;
+    wifiState = WIFI_CONN_CONNECTING;
+    // the credentials are in the NVS already, WiFiManager needs persistence on for new ones
+    WiFi.persistent(false);
+    if (wifiFastAttempt)
+    {
+        WiFi.begin(wifiSSID.c_str(), wifiPass.c_str(), wifiChannel, wifiBSSID);
+    }
+    else
+    {
+        WiFi.begin(wifiSSID.c_str(), wifiPass.c_str());
+    }
+    WiFi.persistent(true);
+}
+
+unsigned long nextWiFiBackoff()
+{
+    unsigned long backoff = WIFI_BACKOFF_MIN << (wifiAttempts < 9 ? wifiAttempts : 9);
+    if (backoff > WIFI_BACKOFF_MAX)
+    {
+        backoff = WIFI_BACKOFF_MAX;
+    }
+    wifiAttempts++;
+    return backoff * (100 - WIFI_JITTER + esp_random() % (2 * WIFI_JITTER + 1)) / 100;
+}
+
+void onWiFiConnected(unsigned long now)
+{
+    wifiStats.lastConnectMs = now - wifiAttemptStart;
+    if (wifiOutageStart != 0)
+    {
+        wifiStats.lastOutageMs = now - wifiOutageStart;
+        wifiStats.totalOutageMs += wifiStats.lastOutageMs;
+        wifiStats.reconnects++;
+        wifiOutageStart = 0;
+    }
+    wifiAttempts = 0;
+    wifiWeakChecks = 0;
+    wifiRSSICheckTimer = now;
+    wifiState = WIFI_CONN_CONNECTED;
+
+    const uint8_t *bssid = WiFi.BSSID();
+    if (bssid != nullptr && (memcmp(bssid, wifiBSSID, 6) != 0 || WiFi.channel() != wifiChannel))
+    {
+        memcpy(wifiBSSID, bssid, 6);
+        wifiChannel = WiFi.channel();
+        storeWiFiCache();
+    }
+    Serial.printf("Wi-Fi connected in %lu ms, channel %d, RSSI %d\n", wifiStats.lastConnectMs, (int)wifiChannel, (int)WiFi.RSSI());
+}
+
+// Boot: direct association with the cached access point, false if it didn't work
+bool wifiFastConnect(const char *hostname)
+{
+    WiFi.setHostname(hostname);
+    WiFi.mode(WIFI_STA);
+    if (!loadWiFiCredentials())
+    {
+        return false;
+    }
+    loadWiFiCache();
+    if (wifiChannel == 0)
+    {
+        return false;
+    }
+    unsigned long start = millis();
+    startWiFiAttempt(start, true);
+    while (WiFi.status() != WL_CONNECTED && millis() - start < WIFI_FAST_TIMEOUT)
+    {
+        delay(10);
+    }
+    if (WiFi.status() != WL_CONNECTED)
+    {
+        WiFi.disconnect();
+        // WiFi.begin() stores the BSSID lock, WiFiManager would only try that access point
+        WiFi.begin(wifiSSID.c_str(), wifiPass.c_str(), 0, nullptr, false);
+        wifiState = WIFI_CONN_IDLE;
+        return false;
+    }
+    onWiFiConnected(millis());
+    return true;
+}
+
+// Call once connected, from then on handleWiFiConnection() keeps the connection
+void beginWiFiConnection()
+{
+    if (!loadWiFiCredentials())
+    {
+        return;
+    }
+    if (wifiChannel == 0)
+    {
+        loadWiFiCache();
+    }
+    WiFi.setAutoReconnect(false);
+    if (wifiState != WIFI_CONN_CONNECTED)
+    {
+        wifiAttemptStart = millis();
+        wifiState = WiFi.status() == WL_CONNECTED ? WIFI_CONN_CONNECTED : WIFI_CONN_WAITING;
+        if (wifiState == WIFI_CONN_CONNECTED)
+        {
+            onWiFiConnected(millis());
+        }
+    }
+}
+
+void checkRoaming(unsigned long now)
+{
+    if (now - wifiRSSICheckTimer < WIFI_RSSI_CHECK)
+    {
+        return;
+    }
+    wifiRSSICheckTimer = now;
+    wifiWeakChecks = WiFi.RSSI() < WIFI_ROAM_RSSI ? wifiWeakChecks + 1 : 0;
+    if (wifiWeakChecks >= WIFI_ROAM_CHECKS)
+    {
+        wifiWeakChecks = 0;
+        WiFi.scanNetworks(true);
+        wifiState = WIFI_CONN_SCANNING;
+    }
+}
+
+void finishRoamingScan(unsigned long now)
+{
+    int count = WiFi.scanComplete();
+    if (count == WIFI_SCAN_RUNNING)
+    {
+        return;
+    }
+    int best = -1;
+    int bestRSSI = WiFi.RSSI() + WIFI_ROAM_GAIN - 1;
+    const uint8_t *current = WiFi.BSSID(); // nullptr if the connection dropped during the scan
+    for (int i = 0; current != nullptr && i < count; i++)
+    {
+        if (WiFi.SSID(i) == wifiSSID && WiFi.RSSI(i) > bestRSSI && memcmp(WiFi.BSSID(i), current, 6) != 0)
+        {
+            best = i;
+            bestRSSI = WiFi.RSSI(i);
+        }
+    }
+    if (best < 0)
+    {
+        WiFi.scanDelete();
+        wifiState = WiFi.status() == WL_CONNECTED ? WIFI_CONN_CONNECTED : WIFI_CONN_WAITING;
+        return;
+    }
+    Serial.printf("roaming to channel %d, RSSI %d -> %d\n", (int)WiFi.channel(best), (int)WiFi.RSSI(), bestRSSI);
+    memcpy(wifiBSSID, WiFi.BSSID(best), 6);
+    wifiChannel = WiFi.channel(best);
+    WiFi.scanDelete();
+    wifiStats.roams++;
+    wifiOutageStart = now;
+    wifiStats.outages++;
+    startWiFiAttempt(now, true);
+}
+
+// Call from loop(), never blocks
+void handleWiFiConnection()
+{
+    unsigned long now = millis();
+    bool connected = WiFi.status() == WL_CONNECTED;
+    switch (wifiState)
+    {
+    case WIFI_CONN_IDLE:
+        break;
+    case WIFI_CONN_CONNECTED:
+        if (!connected)
+        {
+            wifiOutageStart = now;
+            wifiStats.outages++;
+            // a single device losing the connection retries right away
+            startWiFiAttempt(now, true);
+        }
+        else
+        {
+            checkRoaming(now);
+        }
+        break;
+    case WIFI_CONN_CONNECTING:
+        if (connected)
+        {
+            onWiFiConnected(now);
+        }
+        else if (now - wifiAttemptStart > (wifiFastAttempt ? WIFI_FAST_TIMEOUT : WIFI_CONNECT_TIMEOUT))
+        {
+            WiFi.disconnect();
+            wifiStats.failedAttempts++;
+            if (wifiFastAttempt)
+            {
+                startWiFiAttempt(now, false); // the access point may have moved to another channel
+            }
+            else
+            {
+                wifiBackoff = nextWiFiBackoff();
+                wifiWaitStart = now;
+                wifiState = WIFI_CONN_WAITING;
+            }
+        }
+        break;
+    case WIFI_CONN_WAITING:
+        if (connected)
+        {
+            onWiFiConnected(now);
+        }
+        else if (now - wifiWaitStart >= wifiBackoff)
+        {
+            if (wifiOutageStart == 0)
+            {
+                wifiOutageStart = now;
+                wifiStats.outages++;
+            }
+            startWiFiAttempt(now, true);
+        }
+        break;
+    case WIFI_CONN_SCANNING:
+        finishRoamingScan(now);
+        break;
+    }
+}
+
+#endif
@@ -0,0 +1,308 @@
+/*
+Benchmarks of the data path, built for the host by the native environment:
+
+  platformio test -e native -v
+
+Every case reports ns/op and heap allocations/op and is compared to
+baseline.txt next to this file. A case fails if it got slower by more than
+BENCH_THRESHOLD (default 1.3), allocates more than before or has no baseline. Every timing run
+is paired with a fixed reference loop and only the ratio is compared, so a
+baseline from one machine holds on another and a busy machine slows both. A
+case that looks slower is measured again before it fails. BENCH_UPDATE=1 writes
+the current numbers as the new baseline.
+*/
+#include <unity.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <new>
+#include <string>
+#include "ledAnimation.h"
+#include "sampleWindow.h"
+#include "mqttPublisher.h"
+#include "Version.h"
+#include "config.h"
+
+#define BENCH_MIN_TIME 0.02 // s per timing run
+#define BENCH_RUNS 7        // the fastest run counts
+#define BENCH_ATTEMPTS 3    // measurements before a case fails
+
+static unsigned long allocations = 0;
+
+void *operator new(size_t size)
+{
+    allocations++;
+    void *p = malloc(size ? size : 1);
+    if (p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+struct BenchResult
+{
+    double ns;        // per op
+    double allocs;    // per op
+    double reference; // ns per iteration of the reference loop, measured alongside
+};
+
+static std::map<std::string, BenchResult> baseline;
+static std::map<std::string, BenchResult> current;
+static volatile uint32_t sink; // keeps the measured work from being optimized away
+
+static std::string baselinePath()
+{
+    std::string file = __FILE__;
+    return file.substr(0, file.find_last_of("/\\") + 1) + "baseline.txt";
+}
+
+// One case per line: name ns/op allocs/op reference-ns
+static void loadBaseline()
+{
+    FILE *f = fopen(baselinePath().c_str(), "r");
+    if (f == nullptr)
+    {
+        return;
+    }
+    char name[64];
+    BenchResult r;
+    while (fscanf(f, "%63s %lf %lf %lf", name, &r.ns, &r.allocs, &r.reference) == 4)
+    {
+        baseline[name] = r;
+    }
+    fclose(f);
+}
+
+static void storeBaseline()
+{
+    FILE *f = fopen(baselinePath().c_str(), "w");
+    TEST_ASSERT_NOT_NULL_MESSAGE(f, "can't write baseline.txt");
+    for (const auto &c : current)
+    {
+        fprintf(f, "%s %.3f %.3f %.3f\n", c.first.c_str(), c.second.ns, c.second.allocs, c.second.reference);
+    }
+    fclose(f);
+    printf("baseline written to %s\n", baselinePath().c_str());
+}
+
+// Fixed integer work to take the speed of the machine out of the comparison
+static void reference(unsigned long i)
+{
+    uint32_t x = i | 1;
+    for (int k = 0; k < 64; k++)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+    }
+    sink = x;
+}
+
+template <typename F>
+static double timeLoop(F op, unsigned long iterations)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        op(i);
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+template <typename F>
+static BenchResult measure(F op)
+{
+    // iteration counts that run for BENCH_MIN_TIME
+    unsigned long iterations = 1;
+    while (timeLoop(op, iterations) * iterations < BENCH_MIN_TIME * 1e9)
+    {
+        iterations *= 2;
+    }
+    unsigned long referenceIterations = (unsigned long)(BENCH_MIN_TIME * 1e9 / timeLoop(reference, 1000)) + 1;
+
+    BenchResult result = {1e30, 0.0, 1e30};
+    for (int run = 0; run < BENCH_RUNS; run++)
+    {
+        unsigned long before = allocations;
+        double ns = timeLoop(op, iterations);
+        result.allocs = (double)(allocations - before) / iterations;
+        double referenceNs = timeLoop(reference, referenceIterations);
+        result.ns = ns < result.ns ? ns : result.ns;
+        result.reference = referenceNs < result.reference ? referenceNs : result.reference;
+    }
+    return result;
+}
+
+template <typename F>
+static void check(const char *name, F op)
+{
+    double threshold = getenv("BENCH_THRESHOLD") ? atof(getenv("BENCH_THRESHOLD")) : 1.3;
+    auto base = baseline.find(name);
+    BenchResult r;
+    double ratio = 1.0;
+    for (int attempt = 0; attempt < BENCH_ATTEMPTS; attempt++)
+    {
+        BenchResult next = measure(op);
+        double nextRatio = base == baseline.end() ? 1.0 : (next.ns / next.reference) / (base->second.ns / base->second.reference);
+        if (attempt == 0 || nextRatio < ratio)
+        {
+            r = next;
+            ratio = nextRatio;
+        }
+        if (ratio <= threshold || getenv("BENCH_UPDATE") != nullptr)
+        {
+            break;
+        }
+    }
+    current[name] = r;
+    if (base == baseline.end())
+    {
+        printf("%-16s %10.1f ns/op %6.2f allocs/op   (no baseline)\n", name, r.ns, r.allocs);
+        // a new case is only gated once its numbers are in baseline.txt, until then it shows up as ignored
+        if (getenv("BENCH_UPDATE") == nullptr)
+        {
+            TEST_IGNORE_MESSAGE("no baseline, run with BENCH_UPDATE=1 and commit baseline.txt");
+        }
+        return;
+    }
+    printf("%-16s %10.1f ns/op %6.2f allocs/op   %+5.0f %% vs baseline\n", name, r.ns, r.allocs, (ratio - 1.0) * 100.0);
+    if (getenv("BENCH_UPDATE") != nullptr)
+    {
+        return;
+    }
+    char message[128];
+    snprintf(message, sizeof(message), "%s is %.0f %% slower than the baseline", name, (ratio - 1.0) * 100.0);
+    TEST_ASSERT_TRUE_MESSAGE(ratio <= threshold, message);
+    snprintf(message, sizeof(message), "%s allocates %.2f times per op, the baseline %.2f", name, r.allocs, base->second.allocs);
+    TEST_ASSERT_TRUE_MESSAGE(r.allocs <= base->second.allocs + 0.01, message);
+}
+
+// An Environment point as readCO2() writes it
+static const char *ENVIRONMENT_LINE =
+    "Environment,device=CO2\\ Ampel\\ 12345678,SSID=school-net,co2Sensor=MH-Z19 rssi=-67i,wifiChannel=6i,"
+    "wifiConnectMs=812i,wifiOutages=2i,wifiLastOutageMs=4100i,wifiOutageTotalMs=9300i,wifiRoams=1i,"
+    "wifiFailedAttempts=0i,ppm=1123.00,mhzTemp=27.00,readCountSinceLastBoot=5831i,ssDiff=-12.00,s1Diff=-3.00,"
+    "timeAbove500=1830000i,interval=30000i,brightness=180i,ledCurrent=41.20,ventilating=false,"
+    "ventilationCount=3i,occupancy=21.40,outdoorPPM=431.00,minutesSinceVentilation=17i,airExchangeRate=4.10,"
+    "forecastPPM=1310.00,ventilateSoon=true,uptime=86400i,ledDuty=0.21,radioDuty=0.35,"
+    "seaLevelPressure=101890.00,temp=22.30,tempCompensation=-3.40,tempSelfHeating=0.40,humidity=41.00,"
+    "pressure=98610.00 1760000000";
+
+void setUp() {}
+void tearDown() {}
+
+void test_showCO2()
+{
+    check("showCO2", [](unsigned long i) {
+              showCO2(400.0f + (i % 64) * 50.0f);
+              sink = leds[7].r;
+          });
+}
+
+void test_showTemp()
+{
+    check("showTemp", [](unsigned long i) {
+              showTemp(14.0f + (i % 32) * 0.5f);
+              sink = leds[0].r;
+          });
+}
+
+void test_composeFrame()
+{
+    defaultLedLayout(ledLayout);
+    check("composeFrame", [](unsigned long i) {
+              composeFrame(i * 5);
+              sink = ledFrame[0].g;
+          });
+}
+
+void test_addSample()
+{
+    static SampleWindow window;
+    check("addSample", [](unsigned long i) {
+              sink = addSample(window, 1200.0f - (i % 200), i + 1);
+          });
+}
+
+void test_enqueuePoint()
+{
+    static std::string line = ENVIRONMENT_LINE;
+    check("enqueuePoint", [](unsigned long) {
+              enqueuePoint(line);
+              sink = publishQueue.end;
+          });
+}
+
+void test_lineToJson()
+{
+    static std::string line = ENVIRONMENT_LINE;
+    static std::string measurement;
+    static std::string json;
+    check("lineToJson", [](unsigned long) {
+              lineToJson(line, measurement, json);
+              sink = json.size();
+          });
+}
+
+// A full /config.json as loadParamsFromSpiffs() reads it at boot
+static const char *CONFIG_JSON =
+    "{\"influxDBURL\":\"https://influx.example.org:8086\",\"influxDBOrg\":\"school\",\"influxDBBucket\":\"co2\","
+    "\"influxDBToken\":\"aVeryLongTokenThatIsUsuallyEightySixCharactersLongAndEndsWithTwoEqualSigns0123456789abcdefgh==\","
+    "\"lastestVersionURL\":\"https://example.org/version\",\"firmwarePath\":\"https://example.org/fw.bin\","
+    "\"useWifi\":\"1\",\"tempOffsetBME\":\"-3.0\",\"provisioningSeq\":4,\"remoteConfigURL\":\"https://example.org/{chipId}.json\","
+    "\"remoteConfigVersion\":12,\"remoteConfigETag\":\"\\\"5f3a-1c\\\"\",\"measurementInterval\":30000,"
+    "\"maxMeasurementInterval\":300000,\"roomVolume\":210,\"nightStart\":22,\"nightEnd\":6,\"nightBrightness\":16,"
+    "\"ldrPin\":-1,\"timeZone\":\"CET-1CEST,M3.5.0,M10.5.0/3\",\"mqttHost\":\"192.168.1.10\",\"mqttPort\":\"1883\","
+    "\"mqttUser\":\"ampel\",\"mqttPass\":\"secret\",\"mqttTopic\":\"\",\"mqttDiscovery\":\"homeassistant\","
+    "\"tempModel\":{\"warm\":1.2,\"tau\":900,\"led\":2.1,\"radio\":0.8,\"mhz\":0.1}}";
+
+void test_configParse()
+{
+    auto parse = [](unsigned long) {
+        DynamicJsonDocument jsonDoc(CONFIG_DOC_SIZE);
+        deserializeJson(jsonDoc, CONFIG_JSON);
+        applyParams(jsonDoc.as<JsonObject>(), false);
+        sink = measurementInterval;
+    };
+    // checked before timing, check() ends the test while the case has no baseline
+    parse(0);
+    TEST_ASSERT_EQUAL(30000, measurementInterval);
+    TEST_ASSERT_EQUAL_STRING("192.168.1.10", mqttHost);
+    check("configParse", parse);
+}
+
+void test_versionCompare()
+{
+    static const char *versions[] = {"v0.5.15", "v0.5.16", "v0.6.0", "v1.0.2"};
+    check("versionCompare", [](unsigned long i) {
+              sink = Version(versions[i % 4]) < Version(versions[(i + 1) % 4]);
+          });
+}
+
+int main()
+{
+    defineColors();
+    initAnimations();
+    loadBaseline();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_showCO2);
+    RUN_TEST(test_showTemp);
+    RUN_TEST(test_composeFrame);
+    RUN_TEST(test_addSample);
+    RUN_TEST(test_enqueuePoint);
+    RUN_TEST(test_lineToJson);
+    RUN_TEST(test_configParse);
+    RUN_TEST(test_versionCompare);
+    if (getenv("BENCH_UPDATE") != nullptr)
+    {
+        RUN_TEST(storeBaseline);
+    }
+    return UNITY_END();
+}
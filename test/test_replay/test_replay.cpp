@@ -0,0 +1,96 @@
+/*
+Checks the data path on the synthetic traces from tools/syntheticTrace.h, built
+for the host by the native environment:
+
+  platformio test -e native -v
+
+These are the properties the replay tools in tools/ report: the sampler still
+sees threshold crossings in time, every ventilation event is found, the forecast
+warns before each crossing and every injected sensor fault gets flagged.
+*/
+#include <unity.h>
+#include "replay.h"
+
+// Unity's LESS/GREATER_OR_EQUAL compare as integers, the float limits are checked explicitly
+
+static std::vector<TracePoint> week;
+
+void setUp() {}
+void tearDown() {}
+
+void test_sampler()
+{
+    SamplerReplay r = replaySampler(week);
+    TEST_ASSERT_GREATER_OR_EQUAL(1, r.crossed);
+    TEST_ASSERT_TRUE_MESSAGE(r.worstDelay <= 30.0, "threshold crossing seen too late");
+    TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(r.fixedSamples / 3, r.samples, "less than 3x fewer samples than fixed sampling");
+}
+
+void test_analytics()
+{
+    AnalyticsReplay r = replayAnalytics(week);
+    TEST_ASSERT_EQUAL(24, r.trueEvents);
+    TEST_ASSERT_EQUAL_MESSAGE(24, r.matchedEvents, "missed a ventilation event");
+    TEST_ASSERT_EQUAL_MESSAGE(24, r.detectedEvents, "counted events that weren't there");
+    TEST_ASSERT_TRUE_MESSAGE(r.occupancyError <= 3.5f, "occupancy off by more than 3.5 persons");
+}
+
+void test_forecast()
+{
+    ForecastReplay r = replayForecast(week);
+    TEST_ASSERT_GREATER_OR_EQUAL(1, r.crossings);
+    TEST_ASSERT_EQUAL_MESSAGE(r.crossings, r.warned, "crossed 1000 ppm without a warning");
+    TEST_ASSERT_TRUE_MESSAGE(r.meanLead >= 5 * 60.0, "warnings come less than 5 min ahead");
+    TEST_ASSERT_LESS_OR_EQUAL(2, r.falseWarnings);
+    TEST_ASSERT_TRUE_MESSAGE(r.error < r.persistenceError, "forecast no better than the current reading");
+    TEST_ASSERT_TRUE_MESSAGE(r.steadyError < r.steadyPersistenceError, "steady forecast no better than the current reading");
+}
+
+void test_health()
+{
+    std::vector<TracePoint> trace = syntheticWeek(HEALTH_REPLAY_DAYS);
+    // h until the fault has to show up, in the order of healthScenarios
+    const double maxDelay[] = {0.0, 5 * 24.0, 12 * 24.0, 2.0, 2.0, 3.0, 2.0, 3 * 24.0};
+    for (size_t i = 0; i < sizeof(healthScenarios) / sizeof(healthScenarios[0]); i++)
+    {
+        const Scenario &s = healthScenarios[i];
+        HealthReplay r = replayHealth(s, trace);
+        char message[96];
+        snprintf(message, sizeof(message), "%s: flagged before the fault", s.name);
+        TEST_ASSERT_EQUAL_MESSAGE(0, r.falseBefore, message);
+        if (s.fault == FAULT_NONE)
+        {
+            TEST_ASSERT_EQUAL_STRING_MESSAGE("ok", r.last.status, s.name);
+            continue;
+        }
+        snprintf(message, sizeof(message), "%s: not reported as %s", s.name, s.expected);
+        TEST_ASSERT_TRUE_MESSAGE(r.detected >= 0.0, message);
+        snprintf(message, sizeof(message), "%s: reported after %.0f h", s.name, r.detected);
+        TEST_ASSERT_TRUE_MESSAGE(r.detected <= maxDelay[i], message);
+    }
+}
+
+void test_health_lastingTempFault()
+{
+    const Scenario &s = healthScenarios[6];
+    TEST_ASSERT_EQUAL(FAULT_TEMP, s.fault);
+    HealthReplay r = replayHealth(s, syntheticWeek(HEALTH_REPLAY_DAYS));
+    // the offset never goes back, so neither may the status
+    TEST_ASSERT_EQUAL_MESSAGE(r.recordsAfter, r.expectedAfter, "temperature fault no longer flagged");
+    TEST_ASSERT_EQUAL_STRING("temp", r.last.status);
+    // the reference that gets stored in /health.json is still the one from before the fault
+    TEST_ASSERT_FLOAT_WITHIN(0.5f, s.param, r.last.tempDeviation);
+}
+
+int main()
+{
+    week = syntheticWeek();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_sampler);
+    RUN_TEST(test_analytics);
+    RUN_TEST(test_forecast);
+    RUN_TEST(test_health);
+    RUN_TEST(test_health_lastingTempFault);
+    return UNITY_END();
+}
@@ -0,0 +1,674 @@
+/*
+Tests of the CO2 sensor drivers against simulated sensors on a fake UART and a
+fake I2C bus, built for the host by the native environment:
+
+  platformio test -e native -v
+
+The simulated sensors answer like the hardware does according to the
+datasheets and can be told to stay silent, corrupt their checksums or report an
+error status.
+*/
+#include <unity.h>
+#include <deque>
+#include <vector>
+#include "sensorMHZ19.h"
+#include "sensorS8.h"
+#include "sensorSCD30.h"
+#include "sensorSCD4x.h"
+
+// A sensor on the UART, gets every byte the driver writes
+class UartDevice
+{
+public:
+    bool silent = false;
+    bool badChecksum = false;
+
+    virtual ~UartDevice() {}
+    virtual void receive(uint8_t data, std::deque<uint8_t> &rx) = 0;
+};
+
+class FakeUart : public Stream
+{
+public:
+    std::vector<UartDevice *> devices;
+    std::deque<uint8_t> rx;  // bytes waiting for the driver
+    std::vector<uint8_t> tx; // everything the driver sent
+
+    int available() override { return rx.size(); }
+
+    int read() override
+    {
+        if (rx.empty())
+        {
+            return -1;
+        }
+        uint8_t data = rx.front();
+        rx.pop_front();
+        return data;
+    }
+
+    using Stream::write;
+    size_t write(uint8_t data) override
+    {
+        tx.push_back(data);
+        for (UartDevice *device : devices)
+        {
+            device->receive(data, rx);
+        }
+        return 1;
+    }
+};
+
+// SenseAir S8: Modbus RTU at address 0xFE, ignores anything else on the line
+class FakeS8 : public UartDevice
+{
+public:
+    uint16_t co2 = 612;
+    uint16_t status = 0; // IR1 meter status
+    std::vector<uint8_t> lastRequest;
+
+    void receive(uint8_t data, std::deque<uint8_t> &rx) override
+    {
+        frame.push_back(data);
+        if (frame[0] != S8_ADDRESS)
+        {
+            frame.clear(); // not for us, wait for the start of a frame
+            return;
+        }
+        if (frame.size() < 8)
+        {
+            return;
+        }
+        std::vector<uint8_t> request = frame;
+        frame.clear();
+        if (modbusCRC(request.data(), 6) != (request[6] | request[7] << 8) || silent)
+        {
+            return;
+        }
+        lastRequest = request;
+        std::vector<uint8_t> answer;
+        if (request[1] == S8_READ_INPUT)
+        {
+            answer = {S8_ADDRESS, S8_READ_INPUT, 8, (uint8_t)(status >> 8), (uint8_t)status, 0, 0, 0, 0,
+                      (uint8_t)(co2 >> 8), (uint8_t)co2};
+        }
+        else
+        {
+            answer.assign(request.begin(), request.begin() + 6); // writes are echoed
+        }
+        uint16_t crc = modbusCRC(answer.data(), answer.size()) ^ (badChecksum ? 0x0101 : 0);
+        answer.push_back(crc & 0xFF);
+        answer.push_back(crc >> 8);
+        rx.insert(rx.end(), answer.begin(), answer.end());
+    }
+
+private:
+    std::vector<uint8_t> frame;
+};
+
+// MH-Z19: 9 byte commands starting with 0xFF, 9 byte answers
+class FakeMHZ19 : public UartDevice
+{
+public:
+    uint16_t co2 = 845;
+    int temperature = 24;
+
+    void receive(uint8_t data, std::deque<uint8_t> &rx) override
+    {
+        frame.push_back(data);
+        if (frame[0] != 0xFF)
+        {
+            frame.clear();
+            return;
+        }
+        if (frame.size() < 9)
+        {
+            return;
+        }
+        std::vector<uint8_t> command = frame;
+        frame.clear();
+        if (MHZ19::checksum(command.data()) != command[8] || silent)
+        {
+            return;
+        }
+        uint8_t answer[9] = {0xFF, command[2], 0, 0, 0, 0, 0, 0, 0};
+        if (command[2] == 0x86)
+        {
+            answer[2] = co2 >> 8;
+            answer[3] = co2 & 0xFF;
+            answer[4] = temperature + 40;
+        }
+        answer[8] = MHZ19::checksum(answer) + (badChecksum ? 1 : 0);
+        rx.insert(rx.end(), answer, answer + 9);
+    }
+
+private:
+    std::vector<uint8_t> frame;
+};
+
+// Answers the MH-Z19 probe with more than it reads, ending like the start of an S8 answer
+class FakeLineNoise : public UartDevice
+{
+public:
+    void receive(uint8_t data, std::deque<uint8_t> &rx) override
+    {
+        count = data == 0xFF ? 1 : count + 1;
+        if (count == 9)
+        {
+            rx.insert(rx.end(), 9, 0x00);
+            rx.insert(rx.end(), {S8_ADDRESS, S8_READ_INPUT, 8});
+        }
+    }
+
+private:
+    int count = 0;
+};
+
+// A Sensirion sensor on I2C: 16 bit commands, answers are words with a CRC-8 each
+class FakeSensirion
+{
+public:
+    uint8_t address;
+    bool badChecksum = false;
+    std::vector<uint16_t> commands; // every command received
+
+    explicit FakeSensirion(uint8_t address) : address(address) {}
+    virtual ~FakeSensirion() {}
+
+    void command(const std::vector<uint8_t> &bytes)
+    {
+        if (bytes.size() >= 2)
+        {
+            commands.push_back(bytes[0] << 8 | bytes[1]);
+        }
+    }
+
+    std::vector<uint8_t> answer()
+    {
+        std::vector<uint8_t> bytes;
+        if (commands.empty())
+        {
+            return bytes;
+        }
+        std::vector<uint16_t> words = answerTo(commands.back());
+        for (size_t i = 0; i < words.size(); i++)
+        {
+            uint8_t data[2] = {(uint8_t)(words[i] >> 8), (uint8_t)words[i]};
+            bytes.push_back(data[0]);
+            bytes.push_back(data[1]);
+            // the last word of a measurement gets a broken CRC
+            bool corrupt = badChecksum && words.size() > 1 && i == words.size() - 1;
+            bytes.push_back(sensirionCRC(data, 2) ^ (corrupt ? 0xFF : 0));
+        }
+        return bytes;
+    }
+
+    bool received(uint16_t command) const
+    {
+        for (uint16_t c : commands)
+        {
+            if (c == command)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+protected:
+    virtual std::vector<uint16_t> answerTo(uint16_t command) = 0;
+};
+
+class FakeSCD30 : public FakeSensirion
+{
+public:
+    bool ready = false;
+    float co2 = 731.5f;
+    float temperature = 22.25f;
+    float humidity = 41.0f;
+
+    FakeSCD30() : FakeSensirion(SCD30_ADDRESS) {}
+
+protected:
+    std::vector<uint16_t> answerTo(uint16_t command) override
+    {
+        if (command == SCD30_DATA_READY)
+        {
+            return {(uint16_t)(ready ? 1 : 0)};
+        }
+        if (command == SCD30_READ_MEASUREMENT)
+        {
+            std::vector<uint16_t> words;
+            for (float value : {co2, temperature, humidity})
+            {
+                uint32_t bits;
+                memcpy(&bits, &value, sizeof(bits));
+                words.push_back(bits >> 16);
+                words.push_back(bits & 0xFFFF);
+            }
+            return words;
+        }
+        return {};
+    }
+};
+
+class FakeSCD4x : public FakeSensirion
+{
+public:
+    bool ready = false;
+    uint16_t co2 = 1012;
+    uint16_t temperatureTicks = 26214; // 25 °C
+    uint16_t humidityTicks = 32768;    // 50 %
+
+    FakeSCD4x() : FakeSensirion(SCD4X_ADDRESS) {}
+
+protected:
+    std::vector<uint16_t> answerTo(uint16_t command) override
+    {
+        if (command == SCD4X_DATA_READY)
+        {
+            return {(uint16_t)(ready ? 0x8006 : 0x8000)}; // lower 11 bits are 0 while nothing is ready
+        }
+        if (command == SCD4X_READ_MEASUREMENT)
+        {
+            return {co2, temperatureTicks, humidityTicks};
+        }
+        return {};
+    }
+};
+
+class FakeI2C : public TwoWire
+{
+public:
+    std::vector<FakeSensirion *> devices;
+
+    void beginTransmission(uint8_t address) override
+    {
+        target = find(address);
+        pending.clear();
+    }
+
+    using TwoWire::write;
+    size_t write(uint8_t data) override
+    {
+        pending.push_back(data);
+        return 1;
+    }
+
+    uint8_t endTransmission() override
+    {
+        if (target == nullptr)
+        {
+            return 2; // address not acknowledged
+        }
+        target->command(pending);
+        return 0;
+    }
+
+    uint8_t requestFrom(uint8_t address, uint8_t quantity) override
+    {
+        rx.clear();
+        FakeSensirion *device = find(address);
+        if (device == nullptr)
+        {
+            return 0;
+        }
+        std::vector<uint8_t> answer = device->answer();
+        rx.assign(answer.begin(), answer.end());
+        if (rx.size() > quantity)
+        {
+            rx.resize(quantity);
+        }
+        return rx.size();
+    }
+
+    int available() override { return rx.size(); }
+
+    int read() override
+    {
+        if (rx.empty())
+        {
+            return -1;
+        }
+        uint8_t data = rx.front();
+        rx.pop_front();
+        return data;
+    }
+
+private:
+    FakeSensirion *target = nullptr;
+    std::vector<uint8_t> pending;
+    std::deque<uint8_t> rx;
+
+    FakeSensirion *find(uint8_t address)
+    {
+        for (FakeSensirion *device : devices)
+        {
+            if (device->address == address)
+            {
+                return device;
+            }
+        }
+        return nullptr;
+    }
+};
+
+// Enough time for the drivers' poll() rate limits to pass
+static void nextPeriod()
+{
+    advanceHostClock(6000);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_modbusCRC()
+{
+    // read IR4 example from the S8 Modbus documentation: FE 04 00 03 00 01 D5 C5
+    const uint8_t frame[] = {0xFE, 0x04, 0x00, 0x03, 0x00, 0x01};
+    TEST_ASSERT_EQUAL_HEX16(0xC5D5, modbusCRC(frame, sizeof(frame)));
+}
+
+void test_s8_reading()
+{
+    FakeUart uart;
+    FakeS8 s8;
+    uart.devices.push_back(&s8);
+    S8Sensor sensor(uart);
+    TEST_ASSERT_TRUE(sensor.begin());
+
+    s8.co2 = 1234;
+    SensorReading reading;
+    nextPeriod();
+    TEST_ASSERT_FALSE(sensor.poll(reading)); // sends the request
+    TEST_ASSERT_EQUAL_UINT8(S8_READ_INPUT, s8.lastRequest[1]);
+    TEST_ASSERT_TRUE(sensor.poll(reading)); // collects the answer
+    TEST_ASSERT_EQUAL_FLOAT(1234.0f, reading.co2);
+    TEST_ASSERT_TRUE(isnan(reading.temperature));
+    TEST_ASSERT_EQUAL_UINT32(1, sensor.transactions());
+    TEST_ASSERT_EQUAL_UINT32(0, sensor.failures());
+}
+
+void test_s8_badCRC()
+{
+    FakeUart uart;
+    FakeS8 s8;
+    uart.devices.push_back(&s8);
+    S8Sensor sensor(uart);
+    TEST_ASSERT_TRUE(sensor.begin());
+
+    s8.badChecksum = true;
+    SensorReading reading;
+    nextPeriod();
+    sensor.poll(reading);
+    TEST_ASSERT_FALSE(sensor.poll(reading));
+    TEST_ASSERT_FALSE(sensor.ok());
+    TEST_ASSERT_EQUAL_UINT32(1, sensor.failures());
+
+    S8Sensor probed(uart);
+    TEST_ASSERT_FALSE(probed.begin());
+}
+
+void test_s8_statusWord()
+{
+    FakeUart uart;
+    FakeS8 s8;
+    uart.devices.push_back(&s8);
+    S8Sensor sensor(uart);
+    TEST_ASSERT_TRUE(sensor.begin());
+
+    s8.status = 0x0020; // output out of range
+    SensorReading reading;
+    nextPeriod();
+    sensor.poll(reading);
+    TEST_ASSERT_FALSE(sensor.poll(reading));
+    TEST_ASSERT_EQUAL_UINT32(1, sensor.failures());
+
+    s8.status = 0;
+    nextPeriod();
+    sensor.poll(reading);
+    TEST_ASSERT_TRUE(sensor.poll(reading));
+    TEST_ASSERT_TRUE(sensor.ok());
+}
+
+void test_s8_timeout()
+{
+    FakeUart uart;
+    FakeS8 s8;
+    uart.devices.push_back(&s8);
+    S8Sensor sensor(uart);
+    TEST_ASSERT_TRUE(sensor.begin());
+
+    s8.silent = true;
+    SensorReading reading;
+    nextPeriod();
+    TEST_ASSERT_FALSE(sensor.poll(reading));
+    TEST_ASSERT_FALSE(sensor.poll(reading)); // still waiting
+    TEST_ASSERT_EQUAL_UINT32(0, sensor.transactions());
+    advanceHostClock(S8_RESPONSE_TIMEOUT + 1);
+    TEST_ASSERT_FALSE(sensor.poll(reading));
+    TEST_ASSERT_EQUAL_UINT32(1, sensor.failures());
+    TEST_ASSERT_FALSE(sensor.ok());
+
+    // the next period sends a new request and recovers
+    s8.silent = false;
+    nextPeriod();
+    sensor.poll(reading);
+    TEST_ASSERT_TRUE(sensor.poll(reading));
+}
+
+void test_sensirionCRC()
+{
+    // example from the Sensirion datasheets
+    const uint8_t data[] = {0xBE, 0xEF};
+    TEST_ASSERT_EQUAL_HEX8(0x92, sensirionCRC(data, 2));
+}
+
+void test_scd30_dataReady()
+{
+    FakeI2C i2c;
+    FakeSCD30 scd30;
+    i2c.devices.push_back(&scd30);
+    SCD30Sensor sensor(i2c);
+    TEST_ASSERT_TRUE(sensor.begin());
+    TEST_ASSERT_TRUE(scd30.received(SCD30_START_CONTINUOUS));
+
+    SensorReading reading;
+    nextPeriod();
+    TEST_ASSERT_FALSE(sensor.poll(reading));
+    TEST_ASSERT_TRUE(scd30.received(SCD30_DATA_READY));
+    TEST_ASSERT_FALSE(scd30.received(SCD30_READ_MEASUREMENT)); // nothing read before it is ready
+    TEST_ASSERT_TRUE(sensor.ok());
+
+    scd30.ready = true;
+    nextPeriod();
+    TEST_ASSERT_TRUE(sensor.poll(reading));
+    TEST_ASSERT_EQUAL_FLOAT(731.5f, reading.co2);
+    TEST_ASSERT_EQUAL_FLOAT(22.25f, reading.temperature);
+    TEST_ASSERT_EQUAL_FLOAT(41.0f, reading.humidity);
+    TEST_ASSERT_EQUAL_UINT32(0, sensor.failures());
+}
+
+void test_scd30_badCRC()
+{
+    FakeI2C i2c;
+    FakeSCD30 scd30;
+    i2c.devices.push_back(&scd30);
+    SCD30Sensor sensor(i2c);
+    TEST_ASSERT_TRUE(sensor.begin());
+
+    scd30.ready = true;
+    scd30.badChecksum = true;
+    SensorReading reading;
+    nextPeriod();
+    TEST_ASSERT_FALSE(sensor.poll(reading));
+    TEST_ASSERT_FALSE(sensor.ok());
+    TEST_ASSERT_EQUAL_UINT32(1, sensor.failures());
+}
+
+void test_scd4x_dataReady()
+{
+    FakeI2C i2c;
+    FakeSCD4x scd4x;
+    i2c.devices.push_back(&scd4x);
+    SCD4xSensor sensor(i2c);
+    TEST_ASSERT_TRUE(sensor.begin());
+    TEST_ASSERT_TRUE(scd4x.received(SCD4X_STOP_PERIODIC));
+    TEST_ASSERT_EQUAL_HEX16(SCD4X_START_PERIODIC, scd4x.commands.back());
+
+    SensorReading reading;
+    nextPeriod();
+    TEST_ASSERT_FALSE(sensor.poll(reading));
+    TEST_ASSERT_FALSE(scd4x.received(SCD4X_READ_MEASUREMENT));
+
+    scd4x.ready = true;
+    nextPeriod();
+    TEST_ASSERT_TRUE(sensor.poll(reading));
+    TEST_ASSERT_EQUAL_FLOAT(1012.0f, reading.co2);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 25.0f, reading.temperature);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 50.0f, reading.humidity);
+}
+
+void test_scd4x_badCRC()
+{
+    FakeI2C i2c;
+    FakeSCD4x scd4x;
+    i2c.devices.push_back(&scd4x);
+    SCD4xSensor sensor(i2c);
+    TEST_ASSERT_TRUE(sensor.begin());
+
+    scd4x.ready = true;
+    scd4x.badChecksum = true;
+    SensorReading reading;
+    nextPeriod();
+    TEST_ASSERT_FALSE(sensor.poll(reading));
+    TEST_ASSERT_EQUAL_UINT32(1, sensor.failures());
+
+    scd4x.badChecksum = false;
+    nextPeriod();
+    TEST_ASSERT_TRUE(sensor.poll(reading));
+}
+
+void test_mhz19_reading()
+{
+    FakeUart uart;
+    FakeMHZ19 mhz19;
+    uart.devices.push_back(&mhz19);
+    MHZ19Sensor sensor(uart);
+    TEST_ASSERT_TRUE(sensor.begin());
+
+    SensorReading reading;
+    TEST_ASSERT_TRUE(sensor.poll(reading));
+    TEST_ASSERT_EQUAL_FLOAT(845.0f, reading.co2);
+    TEST_ASSERT_EQUAL_FLOAT(24.0f, reading.temperature);
+    TEST_ASSERT_TRUE(isnan(reading.humidity));
+    TEST_ASSERT_FALSE(sensor.poll(reading)); // once per measurement period
+    TEST_ASSERT_EQUAL_UINT32(2, sensor.transactions()); // CO2 and temperature
+}
+
+void test_mhz19_errors()
+{
+    FakeUart uart;
+    FakeMHZ19 mhz19;
+    uart.devices.push_back(&mhz19);
+    MHZ19Sensor sensor(uart);
+    TEST_ASSERT_TRUE(sensor.begin());
+
+    SensorReading reading;
+    mhz19.badChecksum = true;
+    TEST_ASSERT_FALSE(sensor.poll(reading));
+    TEST_ASSERT_FALSE(sensor.ok());
+    TEST_ASSERT_EQUAL_UINT32(2, sensor.failures());
+
+    mhz19.badChecksum = false;
+    mhz19.silent = true;
+    nextPeriod();
+    TEST_ASSERT_FALSE(sensor.poll(reading));
+    TEST_ASSERT_EQUAL_UINT32(4, sensor.failures());
+
+    mhz19.silent = false;
+    nextPeriod();
+    TEST_ASSERT_TRUE(sensor.poll(reading));
+    TEST_ASSERT_TRUE(sensor.ok());
+
+    FakeUart empty;
+    MHZ19Sensor missing(empty);
+    TEST_ASSERT_FALSE(missing.begin());
+}
+
+// Same order as co2SensorCandidates in main.cpp
+struct ProbeBench
+{
+    FakeUart uart;
+    FakeI2C i2c;
+    MHZ19Sensor mhz19Sensor{uart};
+    S8Sensor s8Sensor{uart};
+    SCD30Sensor scd30Sensor{i2c};
+    SCD4xSensor scd4xSensor{i2c};
+    CO2Sensor *candidates[4] = {&scd4xSensor, &scd30Sensor, &mhz19Sensor, &s8Sensor};
+
+    CO2Sensor *detect() { return detectCO2Sensor(candidates, 4); }
+};
+
+void test_probe_mhz19BeforeS8()
+{
+    ProbeBench bench;
+    FakeMHZ19 mhz19;
+    bench.uart.devices.push_back(&mhz19);
+    TEST_ASSERT_EQUAL_PTR(&bench.mhz19Sensor, bench.detect());
+    for (uint8_t data : bench.uart.tx)
+    {
+        TEST_ASSERT_NOT_EQUAL(S8_ADDRESS, data); // an installed MH-Z19 never sees a Modbus frame
+    }
+}
+
+void test_probe_fallbackToS8()
+{
+    ProbeBench bench;
+    FakeS8 s8;
+    FakeLineNoise noise; // left on the line by the MH-Z19 probe, dropped before the S8 is asked
+    bench.uart.devices.push_back(&noise);
+    bench.uart.devices.push_back(&s8);
+    TEST_ASSERT_EQUAL_PTR(&bench.s8Sensor, bench.detect());
+    TEST_ASSERT_EQUAL_HEX8(0xFF, bench.uart.tx[0]); // the MH-Z19 went first
+    TEST_ASSERT_EQUAL_UINT8(S8_READ_INPUT, s8.lastRequest[1]);
+}
+
+void test_probe_i2cFirst()
+{
+    ProbeBench bench;
+    FakeMHZ19 mhz19;
+    FakeSCD30 scd30;
+    bench.uart.devices.push_back(&mhz19);
+    bench.i2c.devices.push_back(&scd30);
+    TEST_ASSERT_EQUAL_PTR(&bench.scd30Sensor, bench.detect());
+    TEST_ASSERT_EQUAL_UINT32(0, bench.uart.tx.size());
+}
+
+void test_probe_nothing()
+{
+    ProbeBench bench;
+    TEST_ASSERT_NULL(bench.detect());
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_modbusCRC);
+    RUN_TEST(test_s8_reading);
+    RUN_TEST(test_s8_badCRC);
+    RUN_TEST(test_s8_statusWord);
+    RUN_TEST(test_s8_timeout);
+    RUN_TEST(test_sensirionCRC);
+    RUN_TEST(test_scd30_dataReady);
+    RUN_TEST(test_scd30_badCRC);
+    RUN_TEST(test_scd4x_dataReady);
+    RUN_TEST(test_scd4x_badCRC);
+    RUN_TEST(test_mhz19_reading);
+    RUN_TEST(test_mhz19_errors);
+    RUN_TEST(test_probe_mhz19BeforeS8);
+    RUN_TEST(test_probe_fallbackToS8);
+    RUN_TEST(test_probe_i2cFirst);
+    RUN_TEST(test_probe_nothing);
+    return UNITY_END();
+}
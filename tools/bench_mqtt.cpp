@@ -0,0 +1,328 @@
+/*
+Host benchmark for the MQTT publisher in src/mqttPublisher.h. Runs a small
+broker stand-in on localhost that acknowledges QoS 1 messages after a fixed
+delay (the round trip to a broker on the LAN) and optionally drops the connection
+every N messages without acknowledging the last one.
+
+Reports messages per second with one message in flight versus the full window,
+and after connection drops the reconnect time and the lost and duplicated
+messages (QoS 1 may duplicate, it must not lose).
+
+  g++ -O2 -pthread -I tools/host -I src -o bench_mqtt tools/bench_mqtt.cpp
+  ./bench_mqtt [messages] [ack delay ms]
+*/
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "mqttPublisher.h"
+
+class TcpClient : public Client
+{
+public:
+    ~TcpClient() { stop(); }
+
+    int connect(const char *host, uint16_t port) override
+    {
+        stop();
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET, host, &addr.sin_addr);
+        if (::connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0)
+        {
+            stop();
+            return 0;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        return 1;
+    }
+
+    size_t write(const uint8_t *buf, size_t size) override
+    {
+        if (fd < 0)
+        {
+            return 0;
+        }
+        ssize_t n = send(fd, buf, size, MSG_NOSIGNAL);
+        return n < 0 ? 0 : n;
+    }
+
+    int available() override
+    {
+        uint8_t b;
+        return fd >= 0 && recv(fd, &b, 1, MSG_PEEK | MSG_DONTWAIT) > 0 ? 1 : 0;
+    }
+
+    int read(uint8_t *buf, size_t size) override
+    {
+        return fd < 0 ? -1 : recv(fd, buf, size, MSG_DONTWAIT);
+    }
+
+    void stop() override
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    uint8_t connected() override
+    {
+        if (fd < 0)
+        {
+            return 0;
+        }
+        uint8_t b;
+        ssize_t n = recv(fd, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+        return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+    }
+
+private:
+    int fd = -1;
+};
+
+struct Broker
+{
+    int ackDelayMs = 5;
+    int dropEvery = 0; // close the connection after this many points, 0 never
+    uint16_t port = 0;
+    std::atomic<bool> running{true};
+    std::vector<int> received; // per sequence number
+    unsigned long points = 0;
+    unsigned long drops = 0;
+    int listenFd = -1;
+    std::thread thread;
+
+    void start(uint32_t messages)
+    {
+        received.assign(messages, 0);
+        listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(listenFd, (sockaddr *)&addr, sizeof(addr));
+        socklen_t length = sizeof(addr);
+        getsockname(listenFd, (sockaddr *)&addr, &length);
+        port = ntohs(addr.sin_port);
+        listen(listenFd, 4);
+        thread = std::thread([this]() { run(); });
+    }
+
+    void stop()
+    {
+        running = false;
+        shutdown(listenFd, SHUT_RDWR);
+        close(listenFd);
+        thread.join();
+    }
+
+    void run()
+    {
+        while (running)
+        {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0)
+            {
+                return;
+            }
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            serve(fd);
+            close(fd);
+        }
+    }
+
+    void serve(int fd)
+    {
+        std::vector<uint8_t> in;
+        std::deque<std::pair<std::chrono::steady_clock::time_point, uint16_t>> pendingAcks;
+        unsigned long sinceConnect = 0;
+        while (running)
+        {
+            pollfd p = {fd, POLLIN, 0};
+            poll(&p, 1, 1);
+            uint8_t chunk[4096];
+            ssize_t n = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+            if (n == 0)
+            {
+                return;
+            }
+            if (n > 0)
+            {
+                in.insert(in.end(), chunk, chunk + n);
+            }
+            // complete packets
+            while (in.size() >= 2)
+            {
+                size_t pos = 1;
+                uint32_t length = 0;
+                int shift = 0;
+                while (pos < in.size() && (in[pos] & 0x80))
+                {
+                    length |= (in[pos++] & 0x7F) << shift;
+                    shift += 7;
+                }
+                if (pos >= in.size())
+                {
+                    break;
+                }
+                length |= in[pos++] << shift;
+                if (in.size() < pos + length)
+                {
+                    break;
+                }
+                uint8_t type = in[0];
+                const uint8_t *body = in.data() + pos;
+                if (type >> 4 == 1)
+                {
+                    const uint8_t connack[] = {0x20, 2, 0, 0};
+                    send(fd, connack, sizeof(connack), MSG_NOSIGNAL);
+                }
+                else if (type >> 4 == 3)
+                {
+                    uint16_t topicLength = (body[0] << 8) | body[1];
+                    std::string topic((const char *)body + 2, topicLength);
+                    size_t offset = 2 + topicLength;
+                    uint16_t id = 0;
+                    if ((type >> 1) & 3)
+                    {
+                        id = (body[offset] << 8) | body[offset + 1];
+                        offset += 2;
+                    }
+                    if (topic == "bench/Environment")
+                    {
+                        std::string payload((const char *)body + offset, length - offset);
+                        size_t at = payload.find("\"ppm\":");
+                        long seq = at == std::string::npos ? -1 : atol(payload.c_str() + at + 6);
+                        if (seq >= 0 && seq < (long)received.size())
+                        {
+                            received[seq]++;
+                        }
+                        points++;
+                        sinceConnect++;
+                        if (dropEvery > 0 && sinceConnect % dropEvery == 0)
+                        {
+                            // gone before the PUBACK, the client has to send it again
+                            drops++;
+                            return;
+                        }
+                    }
+                    if (id != 0)
+                    {
+                        pendingAcks.push_back({std::chrono::steady_clock::now() + std::chrono::milliseconds(ackDelayMs), id});
+                    }
+                }
+                else if (type >> 4 == 12)
+                {
+                    const uint8_t pingresp[] = {0xD0, 0};
+                    send(fd, pingresp, sizeof(pingresp), MSG_NOSIGNAL);
+                }
+                else if (type >> 4 == 14)
+                {
+                    return;
+                }
+                in.erase(in.begin(), in.begin() + pos + length);
+            }
+            auto now = std::chrono::steady_clock::now();
+            while (!pendingAcks.empty() && pendingAcks.front().first <= now)
+            {
+                uint16_t id = pendingAcks.front().second;
+                const uint8_t puback[] = {0x40, 2, (uint8_t)(id >> 8), (uint8_t)(id & 0xFF)};
+                send(fd, puback, sizeof(puback), MSG_NOSIGNAL);
+                pendingAcks.pop_front();
+            }
+        }
+    }
+};
+
+struct Result
+{
+    double seconds;
+    unsigned long lost;
+    unsigned long duplicates;
+    unsigned long connects;
+    double connectMs; // mean over all connects
+};
+
+Result run(uint32_t messages, uint32_t window, int ackDelayMs, int dropEvery)
+{
+    Broker broker;
+    broker.ackDelayMs = ackDelayMs;
+    broker.dropEvery = dropEvery;
+    broker.start(messages);
+
+    TcpClient net;
+    MqttPublisher mqtt(net);
+    mqtt.configure("127.0.0.1", broker.port, "", "", "bench", "", "bench", "bench", "bench");
+    mqtt.inflightLimit = window;
+    publishQueue = PublishQueue();
+    addPublisher(&mqtt);
+
+    char line[64];
+    uint32_t produced = 0;
+    double connectMs = 0;
+    unsigned long connects = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (mqtt.acked < messages)
+    {
+        // keep the queue full without overrunning the publisher
+        while (produced < messages && publishQueue.end - mqtt.acked < PUBLISH_QUEUE_SIZE)
+        {
+            snprintf(line, sizeof(line), "Environment,device=bench ppm=%ui", (unsigned)produced++);
+            enqueuePoint(line);
+        }
+        flushPublishers();
+        if (mqtt.connects != connects)
+        {
+            connects = mqtt.connects;
+            connectMs += mqtt.lastConnectMs;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    net.stop();
+    broker.stop();
+
+    Result result = {seconds, 0, 0, mqtt.connects, mqtt.connects ? connectMs / mqtt.connects : 0};
+    for (int count : broker.received)
+    {
+        result.lost += count == 0 ? 1 : 0;
+        result.duplicates += count > 1 ? count - 1 : 0;
+    }
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t messages = argc > 1 ? atoi(argv[1]) : 1000;
+    int ackDelayMs = argc > 2 ? atoi(argv[2]) : 5;
+
+    printf("%u messages, PUBACK after %d ms\n", (unsigned)messages, ackDelayMs);
+    printf("%-22s %10s %6s %6s %9s %11s\n", "", "msgs/s", "lost", "dups", "connects", "connect ms");
+    const uint32_t windows[] = {1, MQTT_MAX_INFLIGHT};
+    const int dropEvery[] = {0, 100};
+    for (int drop : dropEvery)
+    {
+        for (uint32_t window : windows)
+        {
+            Result r = run(messages, window, ackDelayMs, drop);
+            char label[32];
+            snprintf(label, sizeof(label), "window %u%s", (unsigned)window, drop ? ", drop /100" : "");
+            printf("%-22s %10.0f %6lu %6lu %9lu %11.2f\n", label, messages / r.seconds, r.lost, r.duplicates,
+                   r.connects, r.connectMs);
+        }
+    }
+    return 0;
+}
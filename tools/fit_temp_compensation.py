@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""
+Fit the self-heating model in src/tempCompensation.h from recorded traces.
+
+Export the Environment measurement of one device from Influx as CSV with the
+columns uptime, ledDuty, radioDuty, mhzTemp, temp, tempCompensation and add a
+column reference with the temperature of a reference thermometer placed next to
+the device. Only devices with an MH-Z19 write mhzTemp, the SCD30/SCD4x measure
+ambient temperature and have no self-heating term to fit. Then run
+
+    tools/fit_temp_compensation.py --offset -3.0 trace.csv [trace2.csv ...]
+
+where --offset is the tempOffsetBME the device was configured with. The script
+prints the "tempModel" object to put into the device's /config.json.
+"""
+
+import argparse
+import csv
+import json
+import math
+
+COLUMNS = ("uptime", "ledDuty", "radioDuty", "mhzTemp", "temp", "tempCompensation", "reference")
+
+
+def load(paths):
+    rows = []
+    for path in paths:
+        with open(path, newline="") as f:
+            for row in csv.DictReader(f):
+                try:
+                    rows.append({c: float(row[c]) for c in COLUMNS})
+                except (KeyError, ValueError):
+                    continue  # incomplete row, e.g. BME280 missing
+    return rows
+
+
+def solve(a, b):
+    """Solve the linear system a x = b with Gaussian elimination (partial pivoting)."""
+    n = len(b)
+    m = [row[:] + [b[i]] for i, row in enumerate(a)]
+    for col in range(n):
+        pivot = max(range(col, n), key=lambda r: abs(m[r][col]))
+        if abs(m[pivot][col]) < 1e-12:
+            return None
+        m[col], m[pivot] = m[pivot], m[col]
+        for r in range(col + 1, n):
+            f = m[r][col] / m[col][col]
+            for c in range(col, n + 1):
+                m[r][c] -= f * m[col][c]
+    x = [0.0] * n
+    for r in range(n - 1, -1, -1):
+        x[r] = (m[r][n] - sum(m[r][c] * x[c] for c in range(r + 1, n))) / m[r][r]
+    return x
+
+
+def fit_for_tau(rows, offset, tau):
+    """Least squares for warm, led, radio, mhz with a fixed warm-up time constant."""
+    features = []
+    targets = []
+    for r in rows:
+        raw = r["temp"] - r["tempCompensation"]
+        # the firmware compares the MH-Z19 to this, not to the model-corrected temp
+        static = raw + offset
+        features.append([
+            1.0 - math.exp(-r["uptime"] / tau),
+            r["ledDuty"],
+            r["radioDuty"],
+            r["mhzTemp"] - static,
+        ])
+        # heating the firmware should have subtracted to hit the reference
+        targets.append(static - r["reference"])
+
+    n = len(features[0])
+    ata = [[sum(f[i] * f[j] for f in features) for j in range(n)] for i in range(n)]
+    atb = [sum(f[i] * t for f, t in zip(features, targets)) for i in range(n)]
+    coef = solve(ata, atb)
+    if coef is None:
+        return None, float("inf")
+    rss = sum((sum(c * x for c, x in zip(coef, f)) - t) ** 2 for f, t in zip(features, targets))
+    return coef, math.sqrt(rss / len(targets))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--offset", type=float, default=-3.0, help="tempOffsetBME used while recording")
+    parser.add_argument("traces", nargs="+")
+    args = parser.parse_args()
+
+    rows = load(args.traces)
+    if len(rows) < 10:
+        raise SystemExit("not enough complete rows in the traces")
+
+    best = None
+    # the time constant is not linear in the model, scan it from 1 min to 4 h
+    for tau in (60.0 * 1.15 ** k for k in range(40)):
+        coef, rmse = fit_for_tau(rows, args.offset, tau)
+        if coef is not None and (best is None or rmse < best[2]):
+            best = (tau, coef, rmse)
+
+    tau, (warm, led, radio, mhz), rmse = best
+    print(json.dumps({"tempModel": {
+        "warm": round(warm, 3),
+        "tau": round(tau, 0),
+        "led": round(led, 3),
+        "radio": round(radio, 3),
+        "mhz": round(mhz, 3),
+    }}, indent=2))
+    print("rmse: %.3f °C over %d samples" % (rmse, len(rows)))
+
+
+if __name__ == "__main__":
+    main()
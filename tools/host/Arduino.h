@@ -0,0 +1,108 @@
+/*
+Minimal stand-in for the Arduino core (timing, Stream, Serial, String) so code in src/
+can be compiled and measured on the host by the tools in this directory and the
+tests in test/. Tests can move the clock forward with advanceHostClock().
+*/
+#ifndef HostArduino_H_
+#define HostArduino_H_
+
+#include <chrono>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <thread>
+
+typedef uint8_t byte;
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+#ifdef __GLIBC__
+#define HOST_HAS_STRLCPY __GLIBC_PREREQ(2, 38)
+#elif defined(_WIN32)
+#define HOST_HAS_STRLCPY 0
+#else
+#define HOST_HAS_STRLCPY 1 // macOS and the BSDs
+#endif
+
+#if !HOST_HAS_STRLCPY
+inline size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t length = strlen(src);
+    if (size > 0)
+    {
+        size_t n = length < size - 1 ? length : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return length;
+}
+#endif
+
+class String : public std::string
+{
+public:
+    String() {}
+    String(const char *s) : std::string(s) {}
+    using std::string::operator=;
+};
+
+inline unsigned long &hostClockSkip()
+{
+    static unsigned long skip = 0; // us
+    return skip;
+}
+
+inline void advanceHostClock(unsigned long ms)
+{
+    hostClockSkip() += ms * 1000;
+}
+
+inline unsigned long micros()
+{
+    static auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() +
+           hostClockSkip();
+}
+
+inline unsigned long millis()
+{
+    return micros() / 1000;
+}
+
+inline void delay(unsigned long ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// UART interface the sensor drivers talk through, tests provide the other end
+class Stream
+{
+public:
+    virtual ~Stream() {}
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual size_t write(uint8_t data) = 0;
+    virtual size_t write(const uint8_t *data, size_t length)
+    {
+        for (size_t i = 0; i < length; i++)
+        {
+            write(data[i]);
+        }
+        return length;
+    }
+};
+
+// Log output is dropped on the host
+struct HostSerial
+{
+    template <typename T>
+    void print(const T &) {}
+    template <typename T>
+    void println(const T &) {}
+    void println() {}
+};
+inline HostSerial Serial;
+
+#endif
@@ -0,0 +1,23 @@
+/*
+Minimal stand-in for the Arduino Client interface (WiFiClient on the device) so
+the network code in src/ can be compiled and measured on the host.
+*/
+#ifndef HostClient_H_
+#define HostClient_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+class Client
+{
+public:
+    virtual ~Client() {}
+    virtual int connect(const char *host, uint16_t port) = 0;
+    virtual size_t write(const uint8_t *buf, size_t size) = 0;
+    virtual int available() = 0;
+    virtual int read(uint8_t *buf, size_t size) = 0;
+    virtual void stop() = 0;
+    virtual uint8_t connected() = 0;
+};
+
+#endif
@@ -0,0 +1,35 @@
+/*
+Minimal stand-in for FastLED so the LED code in src/ can be compiled and
+measured on the host by the tools in this directory. Only what the LED headers
+in src/ use is provided.
+*/
+#ifndef HostFastLED_H_
+#define HostFastLED_H_
+
+#include <math.h>
+#include <stdint.h>
+#include "Arduino.h"
+
+struct CRGB
+{
+    uint8_t r = 0, g = 0, b = 0;
+    CRGB() {}
+    CRGB(uint8_t r, uint8_t g, uint8_t b) : r(r), g(g), b(b) {}
+    bool operator==(const CRGB &o) const { return r == o.r && g == o.g && b == o.b; }
+};
+
+inline uint8_t qadd8(uint8_t a, uint8_t b)
+{
+    unsigned sum = a + b;
+    return sum > 255 ? 255 : sum;
+}
+
+struct HostFastLED
+{
+    unsigned long shows = 0;
+    void show() { shows++; }
+    void clear() {}
+};
+HostFastLED FastLED;
+
+#endif
@@ -0,0 +1,108 @@
+/*
+Minimal stand-in for the MH-Z19 library (WiFWaF/MH-Z19) so sensorMHZ19.h can be
+run on the host. It speaks the sensor's 9 byte UART protocol like the library
+does, only the calls the driver makes are provided.
+*/
+#ifndef HostMHZ19_H_
+#define HostMHZ19_H_
+
+#include "Arduino.h"
+
+#define MHZ19_TIMEOUT 500 // ms, as in the library
+
+enum ERRORCODE
+{
+    RESULT_NULL = 0,
+    RESULT_OK = 1,
+    RESULT_TIMEOUT = 2,
+    RESULT_MATCH = 3,
+    RESULT_CRC = 4,
+    RESULT_FILTER = 5,
+    RESULT_FAILED = 6
+};
+
+class MHZ19
+{
+public:
+    byte errorCode = RESULT_NULL;
+
+    void begin(Stream &stream)
+    {
+        serial = &stream;
+        command(0x86, 0); // the library verifies the connection with a read
+    }
+
+    int getCO2()
+    {
+        return command(0x86, 0) ? response[2] << 8 | response[3] : 0;
+    }
+
+    float getTemperature()
+    {
+        return command(0x86, 0) ? response[4] - 40.0f : 0.0f;
+    }
+
+    void setRange(int range) { command(0x99, range); }
+    void calibrate() { command(0x87, 0); }
+    void autoCalibration(bool isON) { command(0x79, isON ? 0xA0 : 0x00); }
+
+    static byte checksum(const byte *packet)
+    {
+        byte sum = 0;
+        for (int i = 1; i < 8; i++)
+        {
+            sum += packet[i];
+        }
+        return 0xFF - sum + 1;
+    }
+
+private:
+    Stream *serial = nullptr;
+    byte response[9];
+
+    // argument goes to bytes 3 (ABC) or 6..7 (range), like the library packs it
+    bool command(byte cmd, int argument)
+    {
+        byte packet[9] = {0xFF, 0x01, cmd, 0, 0, 0, 0, 0, 0};
+        if (cmd == 0x79)
+        {
+            packet[3] = argument;
+        }
+        else
+        {
+            packet[6] = argument >> 8;
+            packet[7] = argument;
+        }
+        packet[8] = checksum(packet);
+        serial->write(packet, sizeof(packet));
+
+        int count = 0;
+        unsigned long start = millis();
+        while (count < 9 && millis() - start < MHZ19_TIMEOUT)
+        {
+            if (serial->available())
+            {
+                response[count++] = serial->read();
+            }
+        }
+        if (count < 9)
+        {
+            errorCode = RESULT_TIMEOUT;
+        }
+        else if (checksum(response) != response[8])
+        {
+            errorCode = RESULT_CRC;
+        }
+        else if (response[1] != cmd)
+        {
+            errorCode = RESULT_MATCH;
+        }
+        else
+        {
+            errorCode = RESULT_OK;
+        }
+        return errorCode == RESULT_OK;
+    }
+};
+
+#endif
@@ -0,0 +1,32 @@
+/*
+Minimal stand-in for the Arduino I2C interface so the Sensirion drivers in src/
+can be run on the host. The methods are virtual here (they are not on the
+device) so tests can put simulated sensors on the bus.
+*/
+#ifndef HostWire_H_
+#define HostWire_H_
+
+#include "Arduino.h"
+
+class TwoWire
+{
+public:
+    virtual ~TwoWire() {}
+    virtual void beginTransmission(uint8_t address) = 0;
+    virtual size_t write(uint8_t data) = 0;
+    virtual size_t write(const uint8_t *data, size_t length)
+    {
+        for (size_t i = 0; i < length; i++)
+        {
+            write(data[i]);
+        }
+        return length;
+    }
+    // 0 on success, 2 if nobody acknowledged the address
+    virtual uint8_t endTransmission() = 0;
+    virtual uint8_t requestFrom(uint8_t address, uint8_t quantity) = 0;
+    virtual int available() = 0;
+    virtual int read() = 0;
+};
+
+#endif
@@ -0,0 +1,198 @@
+#!/usr/bin/env python3
+"""
+Push a signed config bundle to many CO2 Ampel devices on the local network.
+
+Devices built with PROVISIONING_KEY broadcast a hello datagram to UDP port 4211
+(see src/provisioning.h). This tool listens for them, then sends every device the
+bundle from --config signed with the fleet key and waits for the acknowledgements.
+The config file is a JSON object with the keys of /config.json plus wifiSSID and
+wifiPass, e.g.
+
+    {"wifiSSID": "school", "wifiPass": "...", "influxDBURL": "https://...",
+     "influxDBOrg": "...", "influxDBBucket": "...", "influxDBToken": "...",
+     "lastestVersionURL": "...", "firmwarePath": "..."}
+
+    tools/provision.py --key "$PROVISIONING_KEY" --config school.json --listen 10
+
+Use --simulate N to run against N simulated devices on localhost instead and
+report the wall time.
+"""
+
+import argparse
+import hashlib
+import hmac
+import json
+import os
+import select
+import socket
+import threading
+import time
+
+ANNOUNCE_PORT = 4211
+RETRY_INTERVAL = 0.5
+RETRIES = 6
+
+
+def sign(key, payload):
+    return hmac.new(key.encode(), payload, hashlib.sha256).hexdigest().encode()
+
+
+def bundle_packet(key, seq, device, config):
+    payload = json.dumps({"seq": seq, "device": device, "config": config}, separators=(",", ":")).encode()
+    return sign(key, payload) + b"\n" + payload
+
+
+def discover(sock, duration, verbose=True):
+    """Collect hello datagrams for duration seconds, returns {chipId: (address, hello)}."""
+    devices = {}
+    end = time.monotonic() + duration
+    while True:
+        remaining = end - time.monotonic()
+        if remaining <= 0:
+            return devices
+        ready, _, _ = select.select([sock], [], [], remaining)
+        if not ready:
+            continue
+        data, address = sock.recvfrom(2048)
+        try:
+            hello = json.loads(data)
+        except ValueError:
+            continue
+        if hello.get("type") == "hello" and hello.get("chipId") not in devices:
+            devices[hello["chipId"]] = (address, hello)
+            if verbose:
+                print("found %s at %s:%d (%s)" % (hello.get("device"), address[0], address[1], hello.get("version")))
+
+
+def provision(sock, key, config, devices, seq):
+    """Send the bundle to all devices in parallel, retransmit until acked. Returns {chipId: ack}."""
+    pending = {chip: address for chip, (address, _) in devices.items()}
+    packets = {chip: bundle_packet(key, seq, chip, config) for chip in pending}
+    acks = {}
+    for _ in range(RETRIES):
+        if not pending:
+            break
+        for chip, address in pending.items():
+            sock.sendto(packets[chip], address)
+        end = time.monotonic() + RETRY_INTERVAL
+        while pending and time.monotonic() < end:
+            ready, _, _ = select.select([sock], [], [], max(0.0, end - time.monotonic()))
+            if not ready:
+                continue
+            data, _ = sock.recvfrom(2048)
+            try:
+                ack = json.loads(data)
+            except ValueError:
+                continue
+            if ack.get("type") == "ack" and ack.get("chipId") in pending and ack.get("seq") in (seq, 0):
+                acks[ack["chipId"]] = ack
+                del pending[ack["chipId"]]
+    for chip in pending:
+        acks[chip] = {"ok": False, "error": "no answer"}
+    return acks
+
+
+class SimulatedDevice(threading.Thread):
+    """Speaks the device side of the protocol on a localhost socket."""
+
+    def __init__(self, chip_id, key, tool_port):
+        super().__init__(daemon=True)
+        self.chip_id = chip_id
+        self.key = key
+        self.tool_port = tool_port
+        self.seq = 0
+        self.config = {}
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.bind(("127.0.0.1", 0))
+        self.sock.settimeout(0.2)
+        self.stopped = threading.Event()
+
+    def reply(self, address, seq, error=None):
+        ack = {"type": "ack", "chipId": self.chip_id, "seq": seq, "ok": error is None, "restart": error is None}
+        if error:
+            ack["error"] = error
+        self.sock.sendto(json.dumps(ack).encode(), address)
+
+    def run(self):
+        hello = {"type": "hello", "device": "CO2 Ampel " + self.chip_id, "chipId": self.chip_id, "version": "sim", "seq": 0}
+        self.sock.sendto(json.dumps(hello).encode(), ("127.0.0.1", self.tool_port))
+        while not self.stopped.is_set():
+            try:
+                data, address = self.sock.recvfrom(2048)
+            except socket.timeout:
+                continue
+            signature, _, payload = data.partition(b"\n")
+            if not hmac.compare_digest(signature, sign(self.key, payload)):
+                self.reply(address, 0, "bad signature")
+                continue
+            bundle = json.loads(payload)
+            if bundle["device"] not in ("*", self.chip_id):
+                continue
+            if bundle["seq"] <= self.seq:
+                # a retransmit of the bundle we already applied, ack again
+                self.reply(address, bundle["seq"], None if bundle["seq"] == self.seq else "stale seq")
+                continue
+            self.seq = bundle["seq"]
+            self.config = bundle["config"]
+            self.reply(address, self.seq)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--key", default=os.environ.get("PROVISIONING_KEY"), help="fleet key (default $PROVISIONING_KEY)")
+    parser.add_argument("--config", help="JSON file with the config to push")
+    parser.add_argument("--listen", type=float, default=10.0, help="seconds to listen for device announcements")
+    parser.add_argument("--expect", type=int, default=0, help="stop listening once this many devices were found")
+    parser.add_argument("--simulate", type=int, metavar="N", help="provision N simulated devices on localhost")
+    args = parser.parse_args()
+
+    if not args.key:
+        raise SystemExit("no fleet key, use --key or $PROVISIONING_KEY")
+    if args.config:
+        with open(args.config) as f:
+            config = json.load(f)
+    elif args.simulate:
+        config = {"wifiSSID": "sim", "wifiPass": "sim", "influxDBURL": "https://influx.example", "useWifi": "1"}
+    else:
+        raise SystemExit("--config is required")
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1 << 20)
+
+    simulated = []
+    if args.simulate:
+        sock.bind(("127.0.0.1", 0))
+        simulated = [SimulatedDevice("%08d" % i, args.key, sock.getsockname()[1]) for i in range(args.simulate)]
+        args.expect = args.simulate
+    else:
+        sock.bind(("", ANNOUNCE_PORT))
+
+    start = time.monotonic()
+    for device in simulated:
+        device.start()
+
+    devices = {}
+    end = start + args.listen
+    while time.monotonic() < end and (not args.expect or len(devices) < args.expect):
+        devices.update(discover(sock, min(0.2, end - time.monotonic()), verbose=not simulated))
+    discovered = time.monotonic()
+
+    acks = provision(sock, args.key, config, devices, int(time.time()))
+    done = time.monotonic()
+
+    failed = {chip: ack for chip, ack in acks.items() if not ack.get("ok")}
+    for chip, ack in sorted(failed.items()):
+        print("%s failed: %s" % (chip, ack.get("error")))
+    print("provisioned %d/%d devices, discovery %.3f s, provisioning %.3f s, wall time %.3f s" %
+          (len(acks) - len(failed), len(devices), discovered - start, done - discovered, done - start))
+
+    for device in simulated:
+        device.stopped.set()
+        if device.config != config:
+            failed.setdefault(device.chip_id, {"error": "config not applied"})
+    raise SystemExit(1 if failed or not devices else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,144 @@
+/*
+Host renderer for the LED animation engine in src/ledAnimation.h. Renders a few
+seconds of each animation on the frame clock through the brightness stage in
+src/ledBrightness.h, dumps the output frames and measures the time per frame
+(pushing to the strip is not part of it on the host).
+
+The layouts from src/ledLayout.h are timed separately: CPU time per frame on the
+host and the time the strips need on the wire, once as sent in parallel by the
+RMT driver and once as if all LEDs were on one pin.
+
+  g++ -O2 -I tools/host -I src -o render_leds tools/render_leds.cpp
+  ./render_leds            # summary and timing
+  ./render_leds --dump     # additionally one line per frame: ms r,g,b r,g,b ...
+*/
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "ledAnimation.h"
+
+struct Scenario
+{
+    const char *name;
+    float ppm;
+    float temp;
+    uint8_t animations;
+    uint8_t brightness;
+};
+
+struct BenchLayout
+{
+    const char *name;
+    LedLayout layout;
+};
+
+LedLayout barLayout(int leds)
+{
+    // temperature and status at the start, the rest is the CO2 bar graph
+    LedLayout layout;
+    addLedStrip(layout, 5, leds);
+    addLedSegment(layout, LED_ROLE_TEMP, 0, 0, leds / 6, false);
+    addLedSegment(layout, LED_ROLE_STATUS, 0, leds / 6, leds / 30, false);
+    addLedSegment(layout, LED_ROLE_CO2_BAR, 0, leds / 6 + leds / 30, leds - leds / 6 - leds / 30, false);
+    return layout;
+}
+
+LedLayout twoStripLayout()
+{
+    LedLayout layout = barLayout(60);
+    addLedStrip(layout, 18, 60);
+    addLedSegment(layout, LED_ROLE_CO2_BAR, 1, 0, 60, true);
+    return layout;
+}
+
+void benchLayouts()
+{
+    LedLayout scene;
+    defaultLedLayout(scene);
+    const BenchLayout layouts[] = {
+        {"8 LEDs, 1 pin", scene},
+        {"60 LEDs, 1 pin", barLayout(60)},
+        {"120 LEDs, 1 pin", barLayout(120)},
+        {"120 LEDs, 2 pins", twoStripLayout()},
+    };
+    showCO2(2100.0f);
+    showTemp(22.0f);
+    activeAnimations = ANIM_PULSE | ANIM_BREATHING;
+    setGlobalBrightness(128); // dithering on
+
+    printf("\nlayouts (pulse+breathing, brightness 128)\n");
+    for (const BenchLayout &b : layouts)
+    {
+        ledLayout = b.layout;
+        initAnimations();
+        const int frames = 20000;
+        auto start = std::chrono::steady_clock::now();
+        for (int f = 0; f < frames; f++)
+        {
+            composeFrame(f * 5);
+            applyBrightness(ledFrame, ledOutput, ledLayout.totalLeds, f * 5000 + 1);
+        }
+        double nanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / frames;
+        printf("%-18s %6.0f ns/frame (host), wire %5lu us parallel, %5lu us on one pin, at most %3lu frames/s\n", b.name,
+               nanos, frameWireMicros, (unsigned long)ledLayout.totalLeds * LED_WIRE_US + LED_RESET_US,
+               1000000UL / minFrameIntervalMicros);
+    }
+}
+
+static const Scenario scenarios[] = {
+    {"static", 900.0f, 22.0f, 0, 255},
+    {"pulse", 2500.0f, 22.0f, ANIM_PULSE, 255},
+    {"breathing", 600.0f, 19.5f, ANIM_BREATHING, 255},
+    {"pulse+breathing", 3200.0f, 26.5f, ANIM_PULSE | ANIM_BREATHING, 255},
+    {"boot progress", 0.0f, 0.0f, ANIM_BOOT_PROGRESS, 255},
+    {"ota progress", 0.0f, 0.0f, ANIM_OTA_PROGRESS, 255},
+    {"static night", 900.0f, 22.0f, 0, 64},
+    {"pulse night", 2500.0f, 22.0f, ANIM_PULSE, 64},
+};
+
+int main(int argc, char **argv)
+{
+    bool dump = argc > 1 && strcmp(argv[1], "--dump") == 0;
+    defineColors();
+    defaultLedLayout(ledLayout);
+    initAnimations();
+    initBrightness();
+
+    const unsigned long frameMs = 1000 / FRAMES_PER_SECOND;
+    const unsigned long durationMs = 4000; // one breathing period
+
+    for (const Scenario &s : scenarios)
+    {
+        showCO2(s.ppm);
+        showTemp(s.temp);
+        activeAnimations = s.animations;
+        setGlobalBrightness(s.brightness);
+        averageLedCurrent(0);
+
+        unsigned long frames = 0;
+        double nanos = 0.0;
+        for (unsigned long t = 0; t < durationMs; t += frameMs)
+        {
+            // the progress bars fill up over the run
+            animationProgress = t * 255 / durationMs;
+            auto start = std::chrono::steady_clock::now();
+            composeFrame(t);
+            applyBrightness(ledFrame, ledOutput, ledLayout.totalLeds, t * 1000 + 1);
+            nanos += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+            frames++;
+            if (dump)
+            {
+                printf("%s %5lu", s.name, t);
+                for (int i = 0; i < ledLayout.totalLeds; i++)
+                {
+                    printf(" %3d,%3d,%3d", ledOutput[i].r, ledOutput[i].g, ledOutput[i].b);
+                }
+                printf("\n");
+            }
+        }
+        printf("%-16s %lu frames, %.1f ns/frame (host), average LED current %.1f mA\n",
+               s.name, frames, nanos / frames, averageLedCurrent(durationMs * 1000 + 1));
+    }
+    benchLayouts();
+    return 0;
+}
@@ -0,0 +1,407 @@
+/*
+Replays CO2 traces through the data path headers in src/ and measures them
+against the ground truth of the trace. The replay tools in this directory print
+the results for any trace, test/test_replay checks them on the synthetic ones.
+
+A trace is a CSV with seconds,ppm[,ventilating[,occupancy]] per line, the
+optional columns are the ground truth (1 while a window is open, persons in the
+room). Lines that don't parse are skipped.
+*/
+#ifndef Replay_H_
+#define Replay_H_
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "adaptiveSampler.h"
+#include "co2Forecast.h"
+#include "roomAnalytics.h"
+#include "sensorHealth.h"
+#include "syntheticTrace.h"
+
+std::vector<TracePoint> loadTrace(const char *path)
+{
+    std::vector<TracePoint> trace;
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        perror(path);
+        exit(1);
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), f))
+    {
+        TracePoint p = {0.0, 0.0f, -1, NAN};
+        if (sscanf(line, "%lf,%f,%d,%f", &p.seconds, &p.ppm, &p.ventilating, &p.occupancy) >= 2)
+        {
+            trace.push_back(p);
+        }
+    }
+    fclose(f);
+    return trace;
+}
+
+// Adaptive sampler against sampling at the fixed minimum interval
+
+#define REPLAY_THRESHOLDS 3
+static const float replayThresholds[REPLAY_THRESHOLDS] = {1000.0f, 1400.0f, 2000.0f};
+
+struct SamplerReplay
+{
+    unsigned long samples = 0;
+    unsigned long fixedSamples = 0;
+    int crossed = 0;         // thresholds the trace reaches
+    double worstDelay = 0.0; // s from reaching a threshold until a sample saw it
+};
+
+SamplerReplay replaySampler(const std::vector<TracePoint> &trace, unsigned long minInterval = 10000,
+                            unsigned long maxInterval = 120000)
+{
+    SamplerReplay r;
+    if (trace.size() < 2)
+    {
+        return r;
+    }
+    AdaptiveSampler sampler;
+    setSamplerBounds(sampler, minInterval, maxInterval);
+
+    double start = trace.front().seconds;
+    double end = trace.back().seconds;
+    double crossedAt[REPLAY_THRESHOLDS];
+    bool seen[REPLAY_THRESHOLDS];
+    for (int k = 0; k < REPLAY_THRESHOLDS; k++)
+    {
+        crossedAt[k] = -1.0;
+        seen[k] = false;
+    }
+    // threshold crossings in the full resolution trace
+    for (size_t i = 1; i < trace.size(); i++)
+    {
+        for (int k = 0; k < REPLAY_THRESHOLDS; k++)
+        {
+            if (crossedAt[k] < 0.0 && trace[i].ppm >= replayThresholds[k])
+            {
+                crossedAt[k] = trace[i].seconds;
+                r.crossed++;
+            }
+        }
+    }
+
+    size_t cursor = 0;
+    for (double t = start; t <= end;)
+    {
+        while (cursor + 1 < trace.size() && trace[cursor + 1].seconds <= t)
+        {
+            cursor++;
+        }
+        float ppm = trace[cursor].ppm;
+        r.samples++;
+        for (int k = 0; k < REPLAY_THRESHOLDS; k++)
+        {
+            if (!seen[k] && crossedAt[k] >= 0.0 && ppm >= replayThresholds[k])
+            {
+                seen[k] = true;
+                r.worstDelay = t - crossedAt[k] > r.worstDelay ? t - crossedAt[k] : r.worstDelay;
+            }
+        }
+        t += nextSampleInterval(sampler, ppm, (unsigned long)((t - start) * 1000.0)) / 1000.0;
+    }
+    r.fixedSamples = (unsigned long)((end - start) / (minInterval / 1000.0)) + 1;
+    return r;
+}
+
+// Ventilation events and occupancy against the ground truth
+
+struct AnalyticsReplay
+{
+    int trueEvents = 0;
+    int detectedEvents = 0;
+    int matchedEvents = 0;      // true events detected while the window was open
+    float occupancyError = NAN; // persons, mean absolute error
+    float airExchangeRate = NAN;
+};
+
+AnalyticsReplay replayAnalytics(const std::vector<TracePoint> &trace)
+{
+    AnalyticsReplay r;
+    RoomAnalytics room;
+    double start = trace.front().seconds;
+    bool inTrueEvent = false, trueEventMatched = false;
+    unsigned long lastCount = 0;
+    double occupancyError = 0.0;
+    int occupancySamples = 0;
+
+    for (size_t i = 0; i < trace.size(); i++)
+    {
+        const TracePoint &p = trace[i];
+        updateRoomAnalytics(room, p.ppm, (unsigned long)((p.seconds - start) * 1000.0));
+
+        if (p.ventilating == 1 && !inTrueEvent)
+        {
+            r.trueEvents++;
+            inTrueEvent = true;
+            trueEventMatched = false;
+        }
+        if (inTrueEvent && room.ventilating && !trueEventMatched)
+        {
+            r.matchedEvents++;
+            trueEventMatched = true;
+        }
+        if (p.ventilating == 0)
+        {
+            inTrueEvent = false;
+        }
+        if (room.ventilationCount != lastCount)
+        {
+            r.detectedEvents++;
+            lastCount = room.ventilationCount;
+        }
+        // compare occupancy in the second half of the lessons, the estimate needs a few minutes
+        if (!std::isnan(p.occupancy) && i >= 60 && trace[i - 60].occupancy == p.occupancy)
+        {
+            occupancyError += fabs(room.occupancy - p.occupancy);
+            occupancySamples++;
+        }
+    }
+    if (occupancySamples > 0)
+    {
+        r.occupancyError = occupancyError / occupancySamples;
+    }
+    r.airExchangeRate = room.airExchangeRate;
+    return r;
+}
+
+// Forecast error against persistence and "ventilate soon" against the actual crossings
+
+struct ForecastReplay
+{
+    int compared = 0;
+    double error = 0.0;            // ppm, mean absolute error at the horizon
+    double persistenceError = 0.0; // ppm, assuming the level stays as it is
+    int steadyCompared = 0;        // without a change of occupancy or windows within the horizon
+    double steadyError = 0.0;
+    double steadyPersistenceError = 0.0;
+    int crossings = 0; // of FORECAST_WARN_PPM
+    int warned = 0;    // crossings with a warning before
+    double meanLead = 0.0; // s between warning and crossing
+    int falseWarnings = 0; // the level never got there
+};
+
+ForecastReplay replayForecast(const std::vector<TracePoint> &trace)
+{
+    ForecastReplay r;
+    CO2Forecast forecast;
+    double start = trace.front().seconds;
+    size_t future = 0;
+    size_t lastChange = 0;
+    double warnedAt = -1.0;
+    bool above = false;
+
+    for (size_t i = 0; i < trace.size(); i++)
+    {
+        const TracePoint &p = trace[i];
+        if (i > 0 && (p.occupancy != trace[i - 1].occupancy || p.ventilating != trace[i - 1].ventilating))
+        {
+            lastChange = i;
+        }
+        float predicted = updateForecast(forecast, p.ppm, (unsigned long)((p.seconds - start) * 1000.0));
+
+        while (future < trace.size() && trace[future].seconds < p.seconds + FORECAST_HORIZON)
+        {
+            future++;
+        }
+        if (!std::isnan(predicted) && future < trace.size())
+        {
+            r.error += fabs(predicted - trace[future].ppm);
+            r.persistenceError += fabs(p.ppm - trace[future].ppm);
+            r.compared++;
+
+            bool steady = p.ventilating >= 0 && i - lastChange >= FORECAST_WINDOW * FORECAST_STEP / 10000;
+            for (size_t j = i + 1; steady && j <= future; j++)
+            {
+                steady = trace[j].occupancy == p.occupancy && trace[j].ventilating == p.ventilating;
+            }
+            if (steady)
+            {
+                r.steadyError += fabs(predicted - trace[future].ppm);
+                r.steadyPersistenceError += fabs(p.ppm - trace[future].ppm);
+                r.steadyCompared++;
+            }
+        }
+
+        if (forecast.warn && warnedAt < 0.0)
+        {
+            warnedAt = p.seconds;
+        }
+        if (!above && p.ppm >= FORECAST_WARN_PPM)
+        {
+            above = true;
+            r.crossings++;
+            if (warnedAt >= 0.0)
+            {
+                r.warned++;
+                r.meanLead += p.seconds - warnedAt;
+            }
+            warnedAt = -1.0;
+        }
+        else if (above && p.ppm < FORECAST_WARN_PPM - 50.0f)
+        {
+            above = false;
+        }
+        else if (!above && warnedAt >= 0.0 && p.seconds - warnedAt > 2 * FORECAST_HORIZON)
+        {
+            r.falseWarnings++;
+            warnedAt = -1.0;
+        }
+    }
+    if (r.compared > 0)
+    {
+        r.error /= r.compared;
+        r.persistenceError /= r.compared;
+    }
+    if (r.steadyCompared > 0)
+    {
+        r.steadyError /= r.steadyCompared;
+        r.steadyPersistenceError /= r.steadyCompared;
+    }
+    if (r.warned > 0)
+    {
+        r.meanLead /= r.warned;
+    }
+    return r;
+}
+
+// Sensor health with one injected fault. Readings are taken once a minute, the
+// sensor's temperature runs 4 °C above the BME280 and 1 % of the requests fail.
+
+#define HEALTH_REPLAY_DAYS 21
+#define HEALTH_FAULT_DAY 7 // faults start at 9:00 on this day
+#define HEALTH_STATUSES 7
+
+static const char *healthStatuses[HEALTH_STATUSES] = {"ok", "silent", "errors", "implausible", "stuck", "temp", "drift"};
+
+enum Fault
+{
+    FAULT_NONE,
+    FAULT_DRIFT,       // baseline rises by param ppm per day
+    FAULT_STUCK,       // reading freezes for param hours
+    FAULT_SPIKES,      // param spikes of +2000 ppm within an hour
+    FAULT_ERRORS,      // param % of the requests fail for the rest of the day
+    FAULT_TEMP,        // temperature offset moves by param °C
+    FAULT_UNVENTILATED // from then on the room never gets below param ppm
+};
+
+struct Scenario
+{
+    const char *name;
+    Fault fault;
+    float param;
+    const char *expected; // status that should be reported
+};
+
+static const Scenario healthScenarios[] = {
+    {"healthy", FAULT_NONE, 0.0f, "ok"},
+    {"drift +10 ppm/day", FAULT_DRIFT, 10.0f, "drift"},
+    {"drift +3 ppm/day", FAULT_DRIFT, 3.0f, "drift"},
+    {"stuck for 2 h", FAULT_STUCK, 2.0f, "stuck"},
+    {"5 spikes in an hour", FAULT_SPIKES, 5.0f, "implausible"},
+    {"20 % failed requests", FAULT_ERRORS, 20.0f, "errors"},
+    {"temperature offset +5 °C", FAULT_TEMP, 5.0f, "temp"},
+    {"never aired (600 ppm)", FAULT_UNVENTILATED, 600.0f, "drift"},
+};
+
+struct HealthReplay
+{
+    int statusCount[HEALTH_STATUSES] = {0}; // hourly records per status, see healthStatuses
+    int falseBefore = 0;     // non-ok records before the fault
+    double detected = -1.0;  // h from the fault to the first record with the expected status, -1 if missed
+    int expectedAfter = 0;   // records with the expected status after it was first reported
+    int recordsAfter = 0;    // records from the first detection on
+    HealthRecord last;
+};
+
+HealthReplay replayHealth(const Scenario &s, const std::vector<TracePoint> &trace)
+{
+    HealthReplay r;
+    SensorHealth h;
+    unsigned long transactions = 0;
+    unsigned long failures = 0;
+    const double faultStart = (HEALTH_FAULT_DAY * 24 + 9) * 3600.0;
+    float frozen = NAN;
+
+    for (size_t i = 0; i < trace.size(); i += 6)
+    {
+        const TracePoint &p = trace[i];
+        double t = p.seconds;
+        bool faulty = t >= faultStart;
+        float ppm = p.ppm;
+        float ambient = 21.0f + 2.0f * sinf(t / 86400.0f * 6.283f);
+        float sensorTemp = ambient + 4.0f + (i / 6 % 7) * 0.1f;
+
+        transactions += 2;
+        failures += (i / 6) % 100 == 0 ? 1 : 0;
+        switch (s.fault)
+        {
+        case FAULT_DRIFT:
+            ppm += faulty ? s.param * (t - faultStart) / 86400.0 : 0.0f;
+            break;
+        case FAULT_STUCK:
+            if (faulty && t < faultStart + s.param * 3600.0)
+            {
+                frozen = std::isnan(frozen) ? roundf(ppm) : frozen;
+                ppm = frozen;
+            }
+            break;
+        case FAULT_SPIKES:
+            if (faulty && t < faultStart + 3600.0 && (int)((t - faultStart) / 60) % (int)(60 / s.param) == 0)
+            {
+                ppm += 2000.0f;
+            }
+            break;
+        case FAULT_ERRORS:
+            if (faulty && t < (HEALTH_FAULT_DAY + 1) * 86400.0)
+            {
+                failures += (i / 6) % 100 < s.param ? 2 : 0;
+            }
+            break;
+        case FAULT_TEMP:
+            sensorTemp += faulty ? s.param : 0.0f;
+            break;
+        case FAULT_UNVENTILATED:
+            ppm = !faulty || ppm > s.param ? ppm : s.param + (ppm - 420.0f) * 0.1f;
+            break;
+        default:
+            break;
+        }
+
+        unsigned long now = (unsigned long)(t * 1000.0);
+        updateSensorHealth(h, ppm, sensorTemp, ambient, now);
+        if (sensorHealthDue(h, transactions, failures, now))
+        {
+            for (int k = 0; k < HEALTH_STATUSES; k++)
+            {
+                r.statusCount[k] += strcmp(h.record.status, healthStatuses[k]) == 0 ? 1 : 0;
+            }
+            bool expected = strcmp(h.record.status, s.expected) == 0;
+            if (!faulty && strcmp(h.record.status, "ok") != 0)
+            {
+                r.falseBefore++;
+            }
+            if (faulty && r.detected < 0.0 && expected)
+            {
+                r.detected = (t - faultStart) / 3600.0;
+            }
+            if (r.detected >= 0.0)
+            {
+                r.recordsAfter++;
+                r.expectedAfter += expected ? 1 : 0;
+            }
+        }
+    }
+    r.last = h.record;
+    return r;
+}
+
+#endif
@@ -0,0 +1,61 @@
+/*
+Back-tests the forecast in src/co2Forecast.h on CO2 traces and measures the time
+per update.
+
+  g++ -O2 -I src -I tools -o replay_forecast tools/replay_forecast.cpp
+  ./replay_forecast [trace.csv ...]
+
+A trace is a CSV with seconds,ppm per line. Without a trace a synthetic school
+week is used. The forecast error is compared with assuming the level stays as it
+is (persistence), the lead time is how early "ventilate soon" came before the
+level actually reached FORECAST_WARN_PPM.
+*/
+#include <chrono>
+#include <cstdio>
+#include "replay.h"
+
+void replay(const char *name, const std::vector<TracePoint> &trace)
+{
+    ForecastReplay r = replayForecast(trace);
+
+    const int rounds = 20;
+    double start = trace.front().seconds;
+    volatile float sink = 0.0f; // keeps the timed loop from being optimized away
+    auto begin = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++)
+    {
+        CO2Forecast timed;
+        for (const TracePoint &p : trace)
+        {
+            sink += updateForecast(timed, p.ppm, (unsigned long)((p.seconds - start) * 1000.0));
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() / (rounds * trace.size());
+
+    printf("%s: %zu readings, %.1f ns/update (host)\n", name, trace.size(), ns);
+    if (r.compared > 0)
+    {
+        printf("  %.0f min ahead: mean absolute error %.1f ppm, persistence %.1f ppm\n",
+               FORECAST_HORIZON / 60.0f, r.error, r.persistenceError);
+    }
+    if (r.steadyCompared > 0)
+    {
+        printf("  without a change of occupancy or windows: forecast %.1f ppm, persistence %.1f ppm\n",
+               r.steadyError, r.steadyPersistenceError);
+    }
+    printf("  crossings of %.0f ppm: %d, warned before %d (mean lead %.1f min), false warnings %d\n",
+           FORECAST_WARN_PPM, r.crossings, r.warned, r.meanLead / 60.0, r.falseWarnings);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        replay("synthetic week", syntheticWeek());
+    }
+    for (int i = 1; i < argc; i++)
+    {
+        replay(argv[i], loadTrace(argv[i]));
+    }
+    return 0;
+}
@@ -0,0 +1,38 @@
+/*
+Replays CO2 traces through the adaptive sampler in src/adaptiveSampler.h and
+compares it with sampling at the fixed minimum interval.
+
+  g++ -O2 -I src -I tools -o replay_sampler tools/replay_sampler.cpp
+  ./replay_sampler [trace.csv ...]
+
+A trace is a CSV with seconds,ppm per line (e.g. exported from Influx at the
+10 s measurement interval). Without a trace the synthetic school week from
+syntheticTrace.h is replayed.
+*/
+#include <cstdio>
+#include "replay.h"
+
+void replay(const char *name, const std::vector<TracePoint> &trace)
+{
+    if (trace.size() < 2)
+    {
+        printf("%s: trace too short\n", name);
+        return;
+    }
+    SamplerReplay r = replaySampler(trace);
+    printf("%s: %lu samples adaptive vs %lu fixed (%.1fx fewer), worst threshold detection delay %.0f s\n",
+           name, r.samples, r.fixedSamples, (double)r.fixedSamples / r.samples, r.worstDelay);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        replay("synthetic week", syntheticWeek());
+    }
+    for (int i = 1; i < argc; i++)
+    {
+        replay(argv[i], loadTrace(argv[i]));
+    }
+    return 0;
+}
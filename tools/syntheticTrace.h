@@ -0,0 +1,68 @@
+/*
+Synthetic classroom traces for the replay tools, generated with the CO2 mass
+balance of a 200 m3 room at 10 s resolution.
+*/
+#ifndef SyntheticTrace_H_
+#define SyntheticTrace_H_
+
+#include <stdint.h>
+#include <vector>
+
+struct TracePoint
+{
+    double seconds;
+    float ppm;
+    int ventilating; // -1 if unknown
+    float occupancy; // NAN if unknown
+};
+
+// xorshift32, the same sequence with every C library so the tests can check exact counts
+struct TraceRandom
+{
+    uint32_t state;
+    explicit TraceRandom(uint32_t seed) : state(seed ? seed : 1) {}
+    uint32_t operator()()
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+};
+
+// Lessons from 8:00 to 14:00 with 15 to 30 persons and 10 minute breaks, windows
+// opened in most breaks for 3 to 10 minutes, quiet nights
+std::vector<TracePoint> syntheticWeek(int days = 5, unsigned int seed = 7)
+{
+    std::vector<TracePoint> trace;
+    float ppm = 420.0f;
+    TraceRandom random(seed);
+    for (int day = 0; day < days; day++)
+    {
+        int windowMinutes[6];
+        int classSize[6];
+        for (int i = 0; i < 6; i++)
+        {
+            windowMinutes[i] = random() % 4 == 0 ? 0 : 3 + random() % 8;
+            classSize[i] = 15 + random() % 15;
+        }
+        for (int t = 0; t < 24 * 3600; t += 10)
+        {
+            int minute = t / 60;
+            int slot = (minute - 8 * 60) / 60;
+            bool school = minute >= 8 * 60 && minute < 14 * 60;
+            bool lesson = school && (minute - 8 * 60) % 60 < 50;
+            bool ventilating = school && !lesson && (minute - 8 * 60) % 60 - 50 < windowMinutes[slot];
+            int persons = lesson ? classSize[slot] : 0;
+            // 18 l/h CO2 per person, 0.3/h leakage, 8/h with open windows
+            float exchange = ventilating ? 8.0f : 0.3f;
+            float source = persons * 0.018f / 200.0f * 1e6f;
+            ppm += (source + exchange * (420.0f - ppm)) * 10.0f / 3600.0f;
+            float noise = (random() % 1000) / 100.0f - 5.0f;
+            trace.push_back({day * 86400.0 + t, ppm + noise, ventilating ? 1 : 0, (float)persons});
+        }
+    }
+    return trace;
+}
+
+#endif